@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <tl/expected.hpp>
+
+#include "json_writer.h"
+
+namespace cl {
+// Compressed blob envelope. A property opted in with
+// OneNetClient::SetPropertyEncoding carries its value as the JSON string
+//
+//   "$z1:" base64(zlib(blob))
+//
+// zlib is the RFC 1950 stream (deflate at the fastest level plus an adler32
+// trailer, so a corrupted value fails to decode instead of yielding garbage).
+// base64 uses the standard alphabet with padding and no line breaks. The
+// "$z1:" prefix versions the envelope; values without it are plain strings.
+enum class PropertyEncoding {
+  /// @brief the value is sent as an escaped JSON string
+  kPlain,
+  /// @brief the value is compressed into the "$z1:" envelope
+  kCompressed,
+};
+
+/// @brief envelope prefix, "$z1:"
+extern const char kCompressedBlobPrefix[];
+
+/// @brief true if value starts with the envelope prefix
+bool IsCompressedBlob(const char* data, std::size_t size);
+
+/// @brief worst case size of the quoted envelope string for a blob of size
+/// bytes, incompressible data included
+std::size_t CompressedBlobCapacity(std::size_t size);
+
+/// @brief write blob as a quoted envelope string. Compression and base64 run
+/// chunk by chunk straight into writer, so no full size intermediate buffer
+/// is allocated. Returns false, and writer.ok() turns false, when the result
+/// does not fit
+bool WriteCompressedBlob(JsonWriter& writer, const char* data,
+                         std::size_t size);
+
+/// @brief decode an envelope string back into the blob, max_size bounds the
+/// decompressed size
+tl::expected<std::string, std::string> DecodeCompressedBlob(
+    const char* data, std::size_t size, std::size_t max_size);
+}  // namespace cl
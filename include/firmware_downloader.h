@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tl/expected.hpp>
+
+#include "logger.h"
+
+namespace cl {
+// Streams a firmware image over http(s) straight into a preallocated,
+// memory-mapped file and hashes it as the data arrives, so memory use does
+// not grow with the image size. Progress is checkpointed to <path>.progress
+// together with the image's ETag or Last-Modified; an interrupted transfer,
+// in this process or a later one, resumes with a range request guarded by
+// If-Range, so a changed image is downloaded again from the start.
+class FirmwareDownloader {
+ public:
+  struct Options {
+    /// @brief max bytes per second, 0 = unlimited
+    std::size_t rate_limit = 0;
+    /// @brief bytes between two progress checkpoints
+    std::size_t checkpoint_interval = 4 << 20;
+    /// @brief attempts to resume after a failed request
+    int max_retries = 3;
+    /// @brief openssl digest name, e.g. sha256 or md5
+    std::string digest = "sha256";
+    /// @brief ca bundle for https, empty = system default
+    std::string ca_cert_path;
+  };
+
+  struct Result {
+    std::uint64_t size;
+    /// @brief offset the first request started from, 0 = fresh download
+    std::uint64_t resumed_from;
+    /// @brief lowercase hex digest of the whole file
+    std::string digest;
+    double seconds;
+  };
+
+  FirmwareDownloader() : FirmwareDownloader(Options()) {}
+
+  explicit FirmwareDownloader(const Options& options);
+
+  /// @brief download url to path, fails when expectedDigest (hex) is given
+  /// and does not match
+  tl::expected<Result, std::string> Download(
+      const std::string& url, const std::string& path,
+      const std::string& expectedDigest = "");
+
+  /// @brief abort a running download from another thread, progress is kept
+  /// so a later Download on a new downloader resumes it
+  void Cancel();
+
+ private:
+  Options options_;
+  cl::Logger logger_;
+  std::atomic<bool> cancelled_{false};
+};
+}  // namespace cl
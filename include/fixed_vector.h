@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cl {
+// Vector with inline storage for at most N elements. It never allocates;
+// push_back/emplace_back return false once the capacity is exhausted.
+template <typename T, std::size_t N>
+class FixedVector {
+ public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  FixedVector() noexcept = default;
+
+  FixedVector(const FixedVector& other)
+  {
+    for (const auto& v : other) {
+      emplace_back(v);
+    }
+  }
+
+  FixedVector& operator=(const FixedVector& other)
+  {
+    if (this != &other) {
+      clear();
+      for (const auto& v : other) {
+        emplace_back(v);
+      }
+    }
+    return *this;
+  }
+
+  ~FixedVector() { clear(); }
+
+  template <typename... Args>
+  bool emplace_back(Args&&... args)
+  {
+    if (size_ == N) {
+      return false;
+    }
+    new (&storage_[size_]) T(std::forward<Args>(args)...);
+    ++size_;
+    return true;
+  }
+
+  bool push_back(const T& value) { return emplace_back(value); }
+
+  bool push_back(T&& value) { return emplace_back(std::move(value)); }
+
+  void pop_back()
+  {
+    --size_;
+    data()[size_].~T();
+  }
+
+  void clear() noexcept
+  {
+    while (size_ > 0) {
+      pop_back();
+    }
+  }
+
+  T* data() noexcept { return reinterpret_cast<T*>(storage_); }
+  const T* data() const noexcept
+  {
+    return reinterpret_cast<const T*>(storage_);
+  }
+
+  T& operator[](std::size_t i) { return data()[i]; }
+  const T& operator[](std::size_t i) const { return data()[i]; }
+
+  iterator begin() noexcept { return data(); }
+  iterator end() noexcept { return data() + size_; }
+  const_iterator begin() const noexcept { return data(); }
+  const_iterator end() const noexcept { return data() + size_; }
+
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  bool full() const noexcept { return size_ == N; }
+  static constexpr std::size_t capacity() noexcept { return N; }
+
+ private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_[N];
+  std::size_t size_ = 0;
+};
+}  // namespace cl
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace cl {
+// Minimal JSON writer over a caller-provided buffer. It never allocates; once
+// the buffer is exhausted ok() turns false and further writes are ignored.
+class JsonWriter {
+ public:
+  JsonWriter(char* buffer, std::size_t capacity)
+      : buffer_(buffer), capacity_(capacity)
+  {
+  }
+
+  void Raw(const char* s, std::size_t n)
+  {
+    if (!ok_ || capacity_ - size_ < n) {
+      ok_ = false;
+      return;
+    }
+    std::memcpy(buffer_ + size_, s, n);
+    size_ += n;
+  }
+
+  void Raw(const char* s) { Raw(s, std::strlen(s)); }
+
+  void Char(char c) { Raw(&c, 1); }
+
+  /// @brief write a quoted and escaped string
+  void String(const char* s, std::size_t n)
+  {
+    static const char kHex[] = "0123456789abcdef";
+    Char('"');
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < n; i++) {
+      const unsigned char c = static_cast<unsigned char>(s[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        continue;
+      }
+      Raw(s + start, i - start);
+      start = i + 1;
+      switch (c) {
+        case '"':
+          Raw("\\\"", 2);
+          break;
+        case '\\':
+          Raw("\\\\", 2);
+          break;
+        case '\n':
+          Raw("\\n", 2);
+          break;
+        case '\r':
+          Raw("\\r", 2);
+          break;
+        case '\t':
+          Raw("\\t", 2);
+          break;
+        default: {
+          const char esc[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+          Raw(esc, sizeof(esc));
+        }
+      }
+    }
+    Raw(s + start, n - start);
+    Char('"');
+  }
+
+  void String(const char* s) { String(s, std::strlen(s)); }
+
+  void Int(std::int64_t v) { Format("{}", v); }
+
+  void Double(double v)
+  {
+    // NaN and infinity have no JSON representation
+    if (!std::isfinite(v)) {
+      ok_ = false;
+      return;
+    }
+    Format("{}", v);
+  }
+
+  /// @brief write the shortest decimal that reads back as the same float,
+  /// widening to double first would print 23.1f as 23.100000381469727
+  void Float(float v)
+  {
+    if (!std::isfinite(v)) {
+      ok_ = false;
+      return;
+    }
+    Format("{}", v);
+  }
+
+  void Bool(bool v) { v ? Raw("true", 4) : Raw("false", 5); }
+
+  bool ok() const noexcept { return ok_; }
+  const char* data() const noexcept { return buffer_; }
+  std::size_t size() const noexcept { return size_; }
+
+ private:
+  char* buffer_;
+  std::size_t capacity_;
+  std::size_t size_ = 0;
+  bool ok_ = true;
+
+  template <typename T>
+  void Format(fmt::format_string<T> fmt, T v)
+  {
+    if (!ok_) {
+      return;
+    }
+    auto result =
+        fmt::format_to_n(buffer_ + size_, capacity_ - size_, fmt, v);
+    if (result.size > capacity_ - size_) {
+      ok_ = false;
+      return;
+    }
+    size_ += result.size;
+  }
+};
+}  // namespace cl
@@ -3,14 +3,17 @@
 #include <fmt/chrono.h>
 #include <fmt/core.h>
 
-#include <iostream>
+#include <cstdio>
+#include <iterator>
 #include <string>
 
+#include "onenet_config.h"
+
 namespace cl {
 enum class LogLevel { DEBUG, INFO, WARN, ERROR };
 
 // Helper function to convert LogLevel to a string for output
-inline std::string LogLevelToString(LogLevel level)
+inline const char* LogLevelToString(LogLevel level)
 {
   switch (level) {
     case LogLevel::DEBUG:
@@ -39,33 +42,27 @@ class Logger {
   void Log(LogLevel level, fmt::format_string<Args...> fmt,
            Args&&... args) const
   {
-    if (level < min_level_) {
+    // Levels below the compile-time floor are dead code in lite builds
+    if (static_cast<int>(level) < CL_ONENET_LOG_FLOOR || level < min_level_) {
       return;  // Skip messages below the minimum level
     }
 
     // Get the current time for the timestamp
     auto now = std::chrono::system_clock::now();
 
-    // 1. **Timestamp**: Format time (requires fmt/chrono.h)
-    std::string timestamp = fmt::format("{:%Y-%m-%d %H:%M:%S}", now);
-
-    // 2. **Level Tag**: Convert enum to string
-    std::string levelTag = LogLevelToString(level);
-
-    // 3. **Main Message**: Use fmt::format to generate the user's message
-    std::string message = fmt::format(fmt, std::forward<Args>(args)...);
-
-    // Combine all parts into the final log entry
-    std::string final_log =
-        fmt::format("[{}] [{:<5}] {}", timestamp, levelTag, message);
+    // Format timestamp, level tag and the user's message into a single
+    // buffer. Short entries fit the inline storage and never allocate.
+    fmt::memory_buffer entry;
+    fmt::format_to(std::back_inserter(entry), "[{:%Y-%m-%d %H:%M:%S}] [{:<5}] ",
+                   now, LogLevelToString(level));
+    fmt::format_to(std::back_inserter(entry), fmt, std::forward<Args>(args)...);
+    entry.push_back('\n');
 
     // Output to standard error for WARN/ERROR, otherwise standard output
-    if (level == LogLevel::ERROR || level == LogLevel::WARN) {
-      std::cerr << final_log << "\n";
-    }
-    else {
-      std::cout << final_log << "\n";
-    }
+    std::FILE* out = (level == LogLevel::ERROR || level == LogLevel::WARN)
+                         ? stderr
+                         : stdout;
+    std::fwrite(entry.data(), 1, entry.size(), out);
   }
 
   // Convenience wrapper methods
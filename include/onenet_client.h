@@ -2,16 +2,35 @@
 
 #include <any>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
 #include <string>
+#include <thread>
 #include <tl/expected.hpp>
+#include <vector>
 
 #include "any.h"
 #include "base64.h"
+#include "blob_codec.h"
+#include "fixed_vector.h"
+#include "json_writer.h"
 #include "logger.h"
 #include "mqtt/client.h"
+#include "onenet_config.h"
+#include "property.h"
+#include "publish_scheduler.h"
+#include "thing_model_index.h"
+#include "traffic_log.h"
+#include "transport.h"
 #include "url_util.h"
+#include "work_stealing_executor.h"
 
 namespace cl {
 class OneNetClient {
@@ -20,25 +39,210 @@ class OneNetClient {
   static const std::string kCaCert;
   static const std::string kSigningMethod;
   static const std::string kSigningAlgVersion;
+  /// @brief how often throttled messages are retried
+  static const std::chrono::milliseconds kFlushInterval;
+
+  /// @brief handles property/set params, returns the reply code (200 = ok)
+  typedef std::function<int(const nlohmann::json& params)> PropertySetHandler;
+
+  /// @brief handles a service invocation, may fill data, returns the reply
+  /// code (200 = ok). Runs on an executor thread, concurrently with other
+  /// services
+  typedef std::function<int(const nlohmann::json& params, nlohmann::json* data)>
+      ServiceHandler;
+
+  /// @brief how inbound messages reach the dispatcher
+  enum class ReceiveMode {
+    /// @brief dispatch on the mqtt callback thread, reading the payload in
+    /// place. A slow handler holds back the socket instead of growing a queue
+    kCallback,
+    /// @brief hand messages to the connection thread through a queue of at
+    /// most CL_ONENET_RECEIVE_QUEUE_CAPACITY messages, newer ones are
+    /// dropped when it is full
+    kQueue,
+  };
+
+  struct ServiceOptions {
+    /// @brief reply with code 504 when the handler takes longer
+    std::chrono::milliseconds timeout{5000};
+    /// @brief max invocations queued or running at once, more are answered
+    /// with code 503
+    int max_concurrency = 1;
+  };
 
   OneNetClient(bool deviceLevelAuth, std::string productId,
                std::string productSecret, std::string deviceName,
                std::string deviceSecret, std::shared_ptr<cl::Base64> base64,
                std::shared_ptr<cl::UrlUtil> urlUtil);
 
-  ~OneNetClient() = default;
+  /// @brief disconnects first, so no mqtt callback outlives the client
+  ~OneNetClient();
 
   void Connect();
 
   void Disconnect();
 
-  void UploadProperties(std::map<std::string, cl::Any> properties);
+  /// @brief upload properties. Supported value types are bool, int, long,
+  /// long long, unsigned int, unsigned long and unsigned long long (so the
+  /// <cstdint> types up to uint64_t, unsigned values above INT64_MAX are
+  /// rejected), float, double, std::string and const char*
+  tl::expected<void, std::string> UploadProperties(
+      std::map<std::string, cl::Any> properties);
+
+  /// @brief upload a batch of properties without heap allocation on the
+  /// client side. While the upload is throttled, a queued upload with the
+  /// same non zero coalesceKey is replaced instead of queueing another one;
+  /// use it for state where only the latest value matters
+  tl::expected<void, std::string> UploadProperties(
+      const PropertyBatch& properties,
+      PublishPriority priority = PublishPriority::kRealtime,
+      std::uint64_t coalesceKey = 0);
+
+  /// @brief upload a typed property struct generated by onenet-codegen, see
+  /// UploadProperties for coalesceKey
+  template <typename Properties>
+  tl::expected<void, std::string> UploadTypedProperties(
+      const Properties& properties,
+      PublishPriority priority = PublishPriority::kRealtime,
+      std::uint64_t coalesceKey = 0)
+  {
+    if (thing_model_) {
+      tl::expected<void, std::string> valid;
+      properties.ForEachProperty([this, &valid](const Property& property) {
+        if (valid.has_value()) {
+          valid = Validate(property);
+        }
+      });
+      if (!valid.has_value()) {
+        return valid;
+      }
+    }
+    // generated structs serialize strings plainly, compressed properties
+    // only go through UploadProperties
+    if (!compressed_properties_.empty()) {
+      tl::expected<void, std::string> plain;
+      properties.ForEachProperty([this, &plain](const Property& property) {
+        if (plain.has_value() && IsCompressedProperty(property.id)) {
+          plain = tl::make_unexpected<std::string>(fmt::format(
+              "property {} is compressed, upload it with UploadProperties",
+              property.id));
+        }
+      });
+      if (!plain.has_value()) {
+        return plain;
+      }
+    }
+    char payload[CL_ONENET_PAYLOAD_CAPACITY];
+    JsonWriter writer{payload, sizeof(payload)};
+    BeginRequest(writer);
+    properties.Serialize(writer);
+    return FinishRequest(writer, property_post_topic_, priority, coalesceKey);
+  }
+
+  /// @brief set the property/set handler, must be called before Connect
+  void SetPropertySetHandler(PropertySetHandler handler);
+
+  /// @brief register a thing/service/<identifier>/invoke handler, must be
+  /// called before Connect
+  void RegisterService(const std::string& identifier, ServiceHandler handler,
+                       const ServiceOptions& options);
+
+  /// @brief send a string property compressed, see blob_codec.h for the
+  /// envelope. Matching property/set values are decompressed before the
+  /// handler sees them. Posts carrying a compressed blob are serialized into
+  /// a heap buffer sized for the blob, up to CL_ONENET_MAX_BLOB_SIZE bytes.
+  /// UploadTypedProperties rejects structs containing such a property. Must
+  /// be called before Connect
+  void SetPropertyEncoding(const std::string& identifier,
+                           PropertyEncoding encoding);
+
+  /// @brief validate outgoing property batches against the thing model, a
+  /// batch with any invalid property is rejected before publishing. Must be
+  /// called before Connect
+  void SetThingModel(std::shared_ptr<const ThingModelIndex> thingModel);
+
+  /// @brief replace the publish rate limits, drops queued messages. A
+  /// capacity of 0 is taken as 1. Must be called before Connect and never
+  /// while RunPeriodicTasks runs, queued messages are published outside the
+  /// scheduler lock
+  void SetPublishLimits(const PublishScheduler::Options& options);
+
+  /// @brief send outgoing messages through transport instead of the broker,
+  /// must be called before Connect. Connect then starts the connection
+  /// thread without connecting to the broker, it handles messages queued by
+  /// InjectMessage in kQueue mode and runs the periodic tasks
+  void SetTransport(std::shared_ptr<Transport> transport);
+
+  /// @brief record inbound and outbound traffic, must be called before
+  /// Connect
+  void SetTrafficRecorder(std::shared_ptr<TrafficRecorder> recorder);
+
+  /// @brief select how inbound messages are dispatched, kCallback by
+  /// default. Must be called before Connect
+  void SetReceiveMode(ReceiveMode mode);
+
+  /// @brief handle a message as if it was received from the broker. In
+  /// kQueue mode it goes through the receive queue like a broker message
+  void InjectMessage(const std::string& topic, const std::string& payload);
+
+  /// @brief publish a prebuilt payload through the rate limits, see
+  /// UploadProperties for coalesceKey
+  tl::expected<void, std::string> PublishRaw(const std::string& topic,
+                                             const std::string& payload,
+                                             PublishPriority priority,
+                                             std::uint64_t coalesceKey = 0);
+
+  /// @brief flush throttled messages and time out service invocations. Done
+  /// by the connection thread; call it when driving the client without one
+  void RunPeriodicTasks();
+
+  /// @brief number of properties rejected by thing model validation
+  std::uint64_t GetRejectionCount(PropertyCheck reason) const;
+
+  /// @brief number of inbound messages dropped on a full receive queue
+  std::uint64_t GetDroppedMessageCount() const;
+
+  /// @brief number of outgoing messages of this priority shed by the rate
+  /// limits
+  std::uint64_t GetShedCount(PublishPriority priority) const;
+
+  /// @brief number of outgoing messages merged into a queued one
+  std::uint64_t GetCoalescedCount() const;
+
+  /// @brief number of throttled messages waiting to be published
+  std::size_t GetQueuedCount() const;
+
+  /// @brief number of service invocations not answered yet
+  std::size_t GetPendingInvocationCount() const;
 
  private:
+  struct Service {
+    ServiceHandler handler;
+    ServiceOptions options;
+    /// @brief invocations queued or running
+    std::shared_ptr<std::atomic<int>> in_flight;
+  };
+
+  struct ReceivedMessage {
+    mqtt::const_message_ptr message;
+    /// @brief Tracer::Now() when queued, -1 with tracing disabled
+    std::int64_t queued_ns;
+  };
+
+  struct Invocation {
+    std::string id;
+    std::string reply_topic;
+    std::int64_t deadline_ns;
+    /// @brief set by whoever replies first, the handler or the timeout
+    std::atomic<bool> replied{false};
+  };
+
   std::shared_ptr<cl::Base64> base64_;
   std::shared_ptr<cl::UrlUtil> urlUtil_;
 
-  /// @brief mqtt client
+  /// @brief mqtt client. Created without an offline buffer, publishing
+  /// while disconnected fails instead of queueing in paho, so every message
+  /// goes through scheduler_'s rate limits
   mqtt::async_client mqtt_client_;
 
   /// @brief onenet product id
@@ -62,6 +266,82 @@ class OneNetClient {
   /// @brief internal thread
   std::unique_ptr<std::thread> worker_thread_;
 
+  ReceiveMode receive_mode_ = ReceiveMode::kCallback;
+
+  /// @brief guards receive_queue_ and stop_requested_
+  std::mutex receive_mu_;
+
+  /// @brief wakes the connection thread on a queued message or a stop
+  std::condition_variable receive_cv_;
+
+  /// @brief messages waiting for the connection thread, kQueue mode only
+  std::deque<ReceivedMessage> receive_queue_;
+
+  /// @brief set by Disconnect to end RunLoop
+  bool stop_requested_ = false;
+
+  /// @brief inbound messages dropped on a full receive_queue_
+  std::atomic<std::uint64_t> dropped_messages_{0};
+
+  /// @brief topics subscribed after connect, built once at construction
+  cl::FixedVector<std::string, CL_ONENET_MAX_TOPICS> subscribe_topics_;
+
+  /// @brief thing/property/post topic
+  std::string property_post_topic_;
+
+  /// @brief thing/property/set topic
+  std::string property_set_topic_;
+
+  /// @brief thing/property/set_reply topic
+  std::string property_set_reply_topic_;
+
+  /// @brief id of the next outgoing request
+  std::atomic<std::uint32_t> next_message_id_{0};
+
+  /// @brief property/set handler
+  PropertySetHandler property_set_handler_;
+
+  /// @brief sorted identifiers of PropertyEncoding::kCompressed properties
+  std::vector<std::string> compressed_properties_;
+
+  /// @brief thing model used to validate uploads, may be null
+  std::shared_ptr<const ThingModelIndex> thing_model_;
+
+  /// @brief rate limits and queue for outgoing messages
+  PublishScheduler scheduler_;
+
+  /// @brief this device's slot in scheduler_
+  std::uint32_t device_slot_ = 0;
+
+  /// @brief guards scheduler_
+  mutable std::mutex scheduler_mu_;
+
+  /// @brief rejected properties per PropertyCheck reason
+  std::atomic<std::uint64_t>
+      rejections_[static_cast<int>(PropertyCheck::kCount)]{};
+
+  /// @brief replaces the broker for outgoing messages, may be null
+  std::shared_ptr<Transport> transport_;
+
+  /// @brief session traffic recorder, may be null
+  std::shared_ptr<TrafficRecorder> recorder_;
+
+  /// @brief $sys/{pid}/{device}/thing/service/
+  std::string service_topic_prefix_;
+
+  /// @brief registered services by identifier
+  std::map<std::string, Service> services_;
+
+  /// @brief guards invocations_
+  mutable std::mutex invocations_mu_;
+
+  /// @brief invocations waiting for a reply
+  std::vector<std::shared_ptr<Invocation>> invocations_;
+
+  /// @brief runs service handlers, declared last so it is destroyed, and its
+  /// workers joined, before anything the handlers use
+  std::unique_ptr<WorkStealingExecutor> service_executor_;
+
   tl::expected<std::string, std::string> BuildCaFile(
       const std::string& content) const;
 
@@ -71,6 +351,72 @@ class OneNetClient {
       const std::vector<unsigned char>& secretBytes,
       const std::string& message) const;
 
+  bool IsCompressedProperty(const char* identifier) const;
+
+  /// @brief decompress enveloped values of compressed properties in place,
+  /// returns false if one fails to decode
+  bool DecodeCompressedProperties(nlohmann::json& params);
+
+  /// @brief check property against thing_model_, counts rejections
+  tl::expected<void, std::string> Validate(const Property& property);
+
+  /// @brief check an encoded compressed value against the thing model's
+  /// max string length
+  tl::expected<void, std::string> ValidateEncodedLength(const char* id,
+                                                        std::size_t size);
+
+  /// @brief write the request envelope up to the params object
+  void BeginRequest(JsonWriter& writer);
+
+  /// @brief close the request envelope and publish it
+  tl::expected<void, std::string> FinishRequest(
+      JsonWriter& writer, const std::string& topic, PublishPriority priority,
+      std::uint64_t coalesceKey = 0);
+
+  /// @brief publish now if the rate limits allow, queue otherwise
+  tl::expected<void, std::string> Publish(const std::string& topic,
+                                          const char* data, std::size_t size,
+                                          PublishPriority priority,
+                                          std::uint64_t coalesceKey = 0);
+
+  /// @brief publish queued messages the rate limits allow
+  void FlushPublishQueue();
+
+  /// @brief publish immediately, bypassing the rate limits
+  tl::expected<void, std::string> PublishNow(const std::string& topic,
+                                             const char* data,
+                                             std::size_t size);
+
+  /// @brief mqtt message callback, dispatches or queues per receive_mode_
+  void OnMessage(mqtt::const_message_ptr message);
+
+  /// @brief hand a message to the connection thread, dropped when the
+  /// receive queue is full
+  void EnqueueMessage(mqtt::const_message_ptr message);
+
+  void HandleMessage(const std::string& topic, const char* payload,
+                     std::size_t size);
+
+  void HandlePropertySet(const char* payload, std::size_t size);
+
+  void HandleServiceInvoke(const std::string& topic, const char* payload,
+                           std::size_t size);
+
+  /// @brief send the reply unless the invocation was answered already
+  void ReplyService(const std::shared_ptr<Invocation>& invocation, int code,
+                    const nlohmann::json& data);
+
+  /// @brief answer invocations past their deadline with a timeout
+  void ExpireServiceInvocations(std::int64_t now_ns);
+
+  /// @brief clear the message callback and disconnect, which also stops
+  /// automatic reconnect. Called by RunLoop before it returns
+  void CloseConnection();
+
   void RunLoop();
+
+  /// @brief handle queued messages and run the periodic tasks until
+  /// Disconnect, on the connection thread
+  void ServeLoop();
 };
 }  // namespace cl
@@ -0,0 +1,69 @@
+#pragma once
+
+// Compile-time sizing for the client. The default build uses generous limits;
+// the onenet-lite target overrides every value from CMake so the footprint is
+// fixed at configure time.
+
+#ifndef CL_ONENET_LITE
+#define CL_ONENET_LITE 0
+#endif
+
+/// @brief max number of properties in a single upload batch
+#ifndef CL_ONENET_MAX_PROPERTIES
+#define CL_ONENET_MAX_PROPERTIES 128
+#endif
+
+/// @brief max number of topics the client subscribes to
+#ifndef CL_ONENET_MAX_TOPICS
+#define CL_ONENET_MAX_TOPICS 16
+#endif
+
+/// @brief max number of outgoing messages held back by the publish rate
+/// limits, see PublishScheduler
+#ifndef CL_ONENET_PUBLISH_QUEUE_CAPACITY
+#define CL_ONENET_PUBLISH_QUEUE_CAPACITY 256
+#endif
+
+/// @brief max number of inbound messages waiting for the connection thread
+/// in ReceiveMode::kQueue
+#ifndef CL_ONENET_RECEIVE_QUEUE_CAPACITY
+#define CL_ONENET_RECEIVE_QUEUE_CAPACITY 256
+#endif
+
+/// @brief max number of service invocations waiting for a worker
+#ifndef CL_ONENET_SERVICE_QUEUE_CAPACITY
+#define CL_ONENET_SERVICE_QUEUE_CAPACITY 256
+#endif
+
+/// @brief max size in bytes of a serialized outgoing payload
+#ifndef CL_ONENET_PAYLOAD_CAPACITY
+#define CL_ONENET_PAYLOAD_CAPACITY 8192
+#endif
+
+/// @brief max size in bytes of a compressed blob property, before compression
+/// when uploading and after decompression when received
+#ifndef CL_ONENET_MAX_BLOB_SIZE
+#define CL_ONENET_MAX_BLOB_SIZE (1024 * 1024)
+#endif
+
+/// @brief threads running service invocation handlers
+#ifndef CL_ONENET_SERVICE_WORKERS
+#define CL_ONENET_SERVICE_WORKERS 4
+#endif
+
+/// @brief compile span tracing in, see trace.h
+#ifndef CL_ONENET_TRACE
+#define CL_ONENET_TRACE 1
+#endif
+
+/// @brief number of trace events kept per thread
+#ifndef CL_ONENET_TRACE_RING_CAPACITY
+#define CL_ONENET_TRACE_RING_CAPACITY 4096
+#endif
+
+/// @brief log statements below this level are compiled out (lite only)
+#if CL_ONENET_LITE && defined(CL_ONENET_LOG_LEVEL)
+#define CL_ONENET_LOG_FLOOR CL_ONENET_LOG_LEVEL
+#else
+#define CL_ONENET_LOG_FLOOR 0
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "fixed_vector.h"
+#include "onenet_config.h"
+
+namespace cl {
+// Non-owning, allocation free property value. String values point into
+// storage owned by the caller and must outlive the upload call.
+struct PropertyValue {
+  enum class Type { kBool, kInt, kFloat, kDouble, kString };
+
+  struct StringRef {
+    const char* data;
+    std::size_t size;
+  };
+
+  Type type;
+  union {
+    bool b;
+    std::int64_t i;
+    float f;
+    double d;
+    StringRef s;
+  };
+
+  static PropertyValue Bool(bool v)
+  {
+    PropertyValue pv;
+    pv.type = Type::kBool;
+    pv.b = v;
+    return pv;
+  }
+
+  static PropertyValue Int(std::int64_t v)
+  {
+    PropertyValue pv;
+    pv.type = Type::kInt;
+    pv.i = v;
+    return pv;
+  }
+
+  static PropertyValue Float(float v)
+  {
+    PropertyValue pv;
+    pv.type = Type::kFloat;
+    pv.f = v;
+    return pv;
+  }
+
+  static PropertyValue Double(double v)
+  {
+    PropertyValue pv;
+    pv.type = Type::kDouble;
+    pv.d = v;
+    return pv;
+  }
+
+  static PropertyValue String(const char* data, std::size_t size)
+  {
+    PropertyValue pv;
+    pv.type = Type::kString;
+    pv.s.data = data;
+    pv.s.size = size;
+    return pv;
+  }
+
+  static PropertyValue String(const char* data)
+  {
+    return String(data, std::strlen(data));
+  }
+};
+
+struct Property {
+  /// @brief property identifier as defined in the thing model
+  const char* id;
+  PropertyValue value;
+};
+
+/// @brief read a date property sent as a string, a millisecond timestamp in
+/// decimal that fits std::int64_t. Dates may also be sent as json integers
+inline bool ParseDateString(const char* s, std::size_t size, std::int64_t* out)
+{
+  const bool negative = size > 0 && s[0] == '-';
+  std::size_t i = negative ? 1 : 0;
+  if (i == size) {
+    return false;
+  }
+  const std::uint64_t limit =
+      static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) +
+      (negative ? 1 : 0);
+  std::uint64_t v = 0;
+  for (; i < size; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    const unsigned digit = static_cast<unsigned>(s[i] - '0');
+    if (v > (limit - digit) / 10) {
+      return false;
+    }
+    v = v * 10 + digit;
+  }
+  *out = negative && v > 0 ? -static_cast<std::int64_t>(v - 1) - 1
+                           : static_cast<std::int64_t>(v);
+  return true;
+}
+
+/// @brief a batch of properties uploaded in a single property/post message
+typedef FixedVector<Property, CL_ONENET_MAX_PROPERTIES> PropertyBatch;
+}  // namespace cl
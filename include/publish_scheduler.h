@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cl {
+/// @brief publish priority classes, highest first
+enum class PublishPriority {
+  /// @brief thing/event/post
+  kEvent,
+  /// @brief replies to property/get and property/set
+  kReply,
+  /// @brief live property/post
+  kRealtime,
+  /// @brief history backfill, shed first under pressure
+  kBackfill,
+  kCount
+};
+
+// Classic token bucket: refills `rate` tokens per second up to `burst`.
+class TokenBucket {
+ public:
+  TokenBucket(double rate = 0, double burst = 0)
+      : rate_(rate), burst_(burst), tokens_(burst)
+  {
+  }
+
+  /// @brief take one token if available
+  bool TryTake(std::int64_t now_ns)
+  {
+    Refill(now_ns);
+    if (tokens_ < 1) {
+      return false;
+    }
+    tokens_ -= 1;
+    return true;
+  }
+
+  /// @brief take count tokens even when that overdraws the bucket, returns
+  /// the ns to wait until it is out of debt again
+  std::int64_t Consume(double count, std::int64_t now_ns)
+  {
+    Refill(now_ns);
+    tokens_ -= count;
+    if (tokens_ >= 0 || rate_ <= 0) {
+      return 0;
+    }
+    return static_cast<std::int64_t>(-tokens_ / rate_ * 1e9);
+  }
+
+  /// @brief whether a token is available, without taking it
+  bool Ready(std::int64_t now_ns)
+  {
+    Refill(now_ns);
+    return tokens_ >= 1;
+  }
+
+ private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  std::int64_t last_ns_ = -1;
+
+  void Refill(std::int64_t now_ns)
+  {
+    if (last_ns_ >= 0 && now_ns > last_ns_) {
+      tokens_ += rate_ * static_cast<double>(now_ns - last_ns_) / 1e9;
+      if (tokens_ > burst_) {
+        tokens_ = burst_;
+      }
+    }
+    last_ns_ = now_ns;
+  }
+};
+
+// Fixed capacity FIFO of slot indices. Besides the ends it supports removal
+// near the head, which Take needs to skip a throttled device.
+class SlotRing {
+ public:
+  explicit SlotRing(std::size_t capacity = 0) : slots_(capacity) {}
+
+  bool empty() const noexcept { return size_ == 0; }
+  std::size_t size() const noexcept { return size_; }
+
+  std::uint32_t operator[](std::size_t i) const { return slots_[Index(i)]; }
+
+  void push_back(std::uint32_t slot)
+  {
+    slots_[Index(size_)] = slot;
+    size_++;
+  }
+
+  std::uint32_t pop_front()
+  {
+    const std::uint32_t slot = slots_[head_];
+    head_ = Index(1);
+    size_--;
+    return slot;
+  }
+
+  /// @brief remove the i-th element, O(i)
+  void erase(std::size_t i)
+  {
+    for (; i > 0; i--) {
+      slots_[Index(i)] = slots_[Index(i - 1)];
+    }
+    pop_front();
+  }
+
+ private:
+  std::vector<std::uint32_t> slots_;
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+
+  std::size_t Index(std::size_t i) const { return (head_ + i) % slots_.size(); }
+};
+
+// Rate limited publish queue for one connection carrying one or more devices
+// (the device itself and its sub-devices). Every message needs a token from
+// its device bucket and from the connection bucket. Messages leave in
+// priority order; under pressure backfill is shed first, then real-time
+// properties, events and replies are never shed to make room.
+//
+// Messages live in slots allocated once at construction, so queueing copies
+// into existing storage; with Options::payload_reserve covering the largest
+// payload nothing is allocated after construction.
+//
+// Not thread safe, callers serialize access. All operations are O(1) except
+// coalescing and the bounded head-of-line scan in Take.
+class PublishScheduler {
+ public:
+  struct Options {
+    /// @brief per device messages per second
+    double device_rate = 10;
+    double device_burst = 20;
+    /// @brief per connection messages per second
+    double connection_rate = 50;
+    double connection_burst = 100;
+    /// @brief max queued messages across all priorities, 0 is taken as 1
+    std::size_t capacity = 256;
+    /// @brief bytes reserved up front for each queued topic and payload. A
+    /// payload that grew past a non zero payload_reserve is shrunk back
+    /// when its slot is freed
+    std::size_t topic_reserve = 0;
+    std::size_t payload_reserve = 0;
+  };
+
+  struct Message {
+    std::uint32_t device;
+    std::string topic;
+    std::string payload;
+    /// @brief non zero: replaces a queued message with the same device and
+    /// key instead of queueing another one
+    std::uint64_t coalesce_key;
+  };
+
+  PublishScheduler() : PublishScheduler(Options()) {}
+
+  explicit PublishScheduler(const Options& options);
+
+  /// @brief register a device, returns its id
+  std::uint32_t AddDevice();
+
+  /// @brief true when a message of this device may be published right now
+  /// without queueing, takes the tokens if so
+  bool TryAcquire(std::uint32_t device, PublishPriority priority,
+                  std::int64_t now_ns);
+
+  /// @brief queue a copy of the message, returns false when it was shed
+  bool Enqueue(PublishPriority priority, std::uint32_t device,
+               const std::string& topic, const char* data, std::size_t size,
+               std::uint64_t coalesce_key);
+
+  /// @brief dequeue up to max messages the buckets allow to publish, in
+  /// priority order, and write their slots to slots. The messages stay valid
+  /// until Release, so they can be published without holding the lock that
+  /// serializes the scheduler. Returns the number of slots written
+  std::size_t Take(std::int64_t now_ns, std::uint32_t* slots, std::size_t max);
+
+  /// @brief a message returned by Take
+  const Message& message(std::uint32_t slot) const { return slots_[slot]; }
+
+  /// @brief hand slots returned by Take back for reuse
+  void Release(const std::uint32_t* slots, std::size_t count);
+
+  /// @brief queued messages, not counting taken ones
+  std::size_t size() const noexcept { return size_; }
+
+  /// @brief messages dropped from (or refused by) a priority class
+  std::uint64_t shed_count(PublishPriority priority) const
+  {
+    return shed_[static_cast<int>(priority)];
+  }
+
+  /// @brief messages merged into an already queued one
+  std::uint64_t coalesced_count() const noexcept { return coalesced_; }
+
+ private:
+  /// @brief how far Take looks past a blocked device within one class
+  static const std::size_t kScanWindow = 32;
+  /// @brief how many queued messages are searched for a coalesce key
+  static const std::size_t kCoalesceWindow = 64;
+
+  Options options_;
+  TokenBucket connection_bucket_;
+  std::vector<TokenBucket> device_buckets_;
+  std::vector<Message> slots_;
+  std::vector<std::uint32_t> free_slots_;
+  SlotRing queues_[static_cast<int>(PublishPriority::kCount)];
+  std::uint64_t shed_[static_cast<int>(PublishPriority::kCount)] = {};
+  std::uint64_t coalesced_ = 0;
+  std::size_t size_ = 0;
+
+  /// @brief queued message of this device with this key, or null
+  Message* FindCoalesced(const SlotRing& queue, std::uint32_t device,
+                         std::uint64_t coalesce_key);
+
+  /// @brief remove the i-th message of queue and free its slot
+  void Remove(SlotRing& queue, std::size_t i);
+
+  /// @brief return a slot to free_slots_, dropping oversized payload storage
+  void FreeSlot(std::uint32_t slot);
+
+  /// @brief drop the oldest message of a lower class than priority
+  bool ShedBelow(PublishPriority priority);
+};
+
+}  // namespace cl
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tl/expected.hpp>
+#include <vector>
+
+#include "property.h"
+
+namespace cl {
+/// @brief outcome of validating one property against the thing model
+enum class PropertyCheck {
+  kOk,
+  kUnknownProperty,
+  kTypeMismatch,
+  kOutOfRange,
+  kInvalidEnum,
+  kStringTooLong,
+  kCount
+};
+
+inline const char* PropertyCheckToString(PropertyCheck check)
+{
+  switch (check) {
+    case PropertyCheck::kOk:
+      return "ok";
+    case PropertyCheck::kUnknownProperty:
+      return "unknown property";
+    case PropertyCheck::kTypeMismatch:
+      return "type mismatch";
+    case PropertyCheck::kOutOfRange:
+      return "out of range";
+    case PropertyCheck::kInvalidEnum:
+      return "invalid enum value";
+    case PropertyCheck::kStringTooLong:
+      return "string too long";
+    default:
+      return "unknown";
+  }
+}
+
+// Read-only index of the property definitions of a OneNET thing model. Built
+// once from the exported json; lookups binary search a flat sorted table and
+// never allocate, so Check() is cheap enough for the upload path.
+class ThingModelIndex {
+ public:
+  enum class Type : std::uint8_t {
+    kInt32,
+    kInt64,
+    kFloat,
+    kDouble,
+    kBool,
+    kEnum,
+    kString,
+    kDate,
+    kBitMap,
+    /// @brief struct and array, accepted without checks
+    kOther
+  };
+
+  static tl::expected<ThingModelIndex, std::string> Load(
+      const std::string& path);
+
+  /// @brief fails naming the property when a min, max, length or enum value
+  /// in its specs is not a number
+  static tl::expected<ThingModelIndex, std::string> Parse(
+      const std::string& json);
+
+  PropertyCheck Check(const Property& property) const;
+
+  /// @brief max string length of a property, 0 = unlimited or unknown
+  std::size_t MaxLength(const char* id) const;
+
+  std::size_t size() const noexcept { return entries_.size(); }
+
+ private:
+  struct Entry {
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+    Type type;
+    bool has_min;
+    bool has_max;
+    double min;
+    double max;
+    /// @brief max string length, 0 = unlimited
+    std::uint32_t max_length;
+    /// @brief slice of enum_values_, sorted
+    std::uint32_t enum_begin;
+    std::uint32_t enum_count;
+  };
+
+  /// @brief all identifiers back to back, entries point into it
+  std::string names_;
+  /// @brief sorted by identifier
+  std::vector<Entry> entries_;
+  std::vector<std::int64_t> enum_values_;
+
+  const Entry* Find(const char* id, std::size_t size) const;
+
+  bool InRange(const Entry& entry, double v) const;
+};
+}  // namespace cl
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "onenet_config.h"
+
+namespace cl {
+struct TraceEvent {
+  /// @brief span name, must be a string literal
+  const char* name;
+  /// @brief start time in ns since the tracer epoch
+  std::int64_t start_ns;
+  /// @brief duration in ns
+  std::int64_t duration_ns;
+};
+
+// Process wide span tracer. Every thread records into its own fixed size ring
+// buffer, so recording never locks; the oldest events are overwritten once a
+// ring is full. When tracing is disabled a span costs one relaxed load.
+class Tracer {
+ public:
+  static void Enable(bool enabled)
+  {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  static bool IsEnabled()
+  {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// @brief ns elapsed since the tracer epoch
+  static std::int64_t Now();
+
+  static void Record(const char* name, std::int64_t start_ns,
+                     std::int64_t duration_ns);
+
+  /// @brief dump every thread's ring as chrome trace-event json
+  static std::string DumpChromeTrace();
+
+  /// @brief write DumpChromeTrace() to a file, returns false on io error
+  static bool WriteChromeTrace(const std::string& path);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// RAII span, records [construction, destruction) when tracing is enabled
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(name), start_ns_(Tracer::IsEnabled() ? Tracer::Now() : -1)
+  {
+  }
+
+  ~TraceSpan()
+  {
+    if (start_ns_ >= 0) {
+      Tracer::Record(name_, start_ns_, Tracer::Now() - start_ns_);
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* name_;
+  std::int64_t start_ns_;
+};
+}  // namespace cl
+
+#define CL_TRACE_CONCAT_IMPL(a, b) a##b
+#define CL_TRACE_CONCAT(a, b) CL_TRACE_CONCAT_IMPL(a, b)
+
+#if CL_ONENET_TRACE
+#define CL_TRACE_SPAN(name) \
+  cl::TraceSpan CL_TRACE_CONCAT(cl_trace_span_, __LINE__) { name }
+#else
+#define CL_TRACE_SPAN(name)
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace cl {
+// Binary session log. After the "ONRL" magic and a version byte, the file is
+// a sequence of records starting with a kind byte:
+//   topic    : kind=0, varint id, varint length, topic
+//   inbound  : kind=1, varint topic id, varint delta ns, varint length, payload
+//   outbound : kind=2, same layout as inbound
+// Topics are written once and referenced by id; timestamps are deltas to the
+// previous record, so most headers take a handful of bytes.
+enum class TrafficDirection : std::uint8_t { kInbound = 1, kOutbound = 2 };
+
+struct TrafficRecord {
+  TrafficDirection direction;
+  std::string topic;
+  /// @brief ns since the recording started
+  std::int64_t timestamp_ns;
+  std::string payload;
+};
+
+// Append-only writer. Records are encoded into an in-memory buffer that is
+// written out whenever it fills up, so recording costs a lock and a memcpy.
+class TrafficRecorder {
+ public:
+  static tl::expected<std::unique_ptr<TrafficRecorder>, std::string> Open(
+      const std::string& path);
+
+  ~TrafficRecorder();
+
+  TrafficRecorder(const TrafficRecorder&) = delete;
+  TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+  void Record(TrafficDirection direction, const std::string& topic,
+              const char* data, std::size_t size);
+
+  /// @brief write buffered records to the file
+  void Flush();
+
+ private:
+  static const std::size_t kBufferSize = 64 * 1024;
+
+  std::FILE* file_;
+  std::mutex mu_;
+  std::vector<char> buffer_;
+  std::unordered_map<std::string, std::uint32_t> topic_ids_;
+  std::int64_t start_ns_;
+  std::int64_t last_ns_ = 0;
+
+  explicit TrafficRecorder(std::FILE* file);
+
+  void PutVarint(std::uint64_t v);
+
+  void FlushLocked();
+};
+
+class TrafficReader {
+ public:
+  static tl::expected<std::unique_ptr<TrafficReader>, std::string> Open(
+      const std::string& path);
+
+  ~TrafficReader();
+
+  TrafficReader(const TrafficReader&) = delete;
+  TrafficReader& operator=(const TrafficReader&) = delete;
+
+  /// @brief read the next message record, false at the end of the log or on
+  /// a corrupt record (see error())
+  bool Next(TrafficRecord* record);
+
+  const std::string& error() const noexcept { return error_; }
+
+ private:
+  std::FILE* file_;
+  std::vector<std::string> topics_;
+  std::int64_t last_ns_ = 0;
+  std::string error_;
+
+  explicit TrafficReader(std::FILE* file);
+
+  bool GetVarint(std::uint64_t* v);
+
+  bool GetBytes(std::uint64_t size, std::string* out);
+};
+}  // namespace cl
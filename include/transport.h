@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace cl {
+// Outbound side of the client. The default goes to the mqtt broker; replay
+// and load tests plug in a local one to run the client without a network.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  virtual void Publish(const std::string& topic, const char* data,
+                       std::size_t size) = 0;
+};
+}  // namespace cl
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cl {
+// Fixed pool of workers, each with its own task deque. Submit spreads tasks
+// round robin; a worker takes from the front of its own deque and, when that
+// is empty, steals from the back of the others, so one long task never
+// strands the work queued behind it. The number of queued tasks is bounded
+// and Submit never blocks.
+class WorkStealingExecutor {
+ public:
+  typedef std::function<void()> Task;
+
+  WorkStealingExecutor(std::size_t threads, std::size_t capacity);
+
+  ~WorkStealingExecutor();
+
+  WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+  /// @brief queue a task, returns false when the executor is full or stopped
+  bool Submit(Task task);
+
+  /// @brief stop accepting tasks, wait for the running ones, then drop the
+  /// queued ones
+  void Shutdown();
+
+ private:
+  struct Worker {
+    std::mutex mu;
+    std::deque<Task> tasks;
+  };
+
+  std::size_t capacity_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<std::size_t> queued_{0};
+  std::atomic<std::size_t> next_{0};
+  std::atomic<bool> stopped_{false};
+  std::mutex wake_mu_;
+  std::condition_variable wake_cv_;
+
+  bool TryPop(std::size_t self, Task* task);
+
+  void Run(std::size_t self);
+};
+}  // namespace cl
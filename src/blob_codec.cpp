@@ -0,0 +1,217 @@
+#include "blob_codec.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+const char cl::kCompressedBlobPrefix[] = "$z1:";
+
+namespace {
+// multiple of 3, so a full chunk encodes to base64 without padding
+const std::size_t kChunkSize = 3 * 1024;
+const std::size_t kPrefixSize = sizeof(cl::kCompressedBlobPrefix) - 1;
+
+const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int Base64Value(char c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+/// @brief base64 encode at most kChunkSize bytes into writer
+void WriteBase64(cl::JsonWriter& writer, const unsigned char* in,
+                 std::size_t size)
+{
+  char out[kChunkSize / 3 * 4];
+  std::size_t n = 0;
+  std::size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    const std::uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+    out[n++] = kBase64Chars[(v >> 18) & 0x3f];
+    out[n++] = kBase64Chars[(v >> 12) & 0x3f];
+    out[n++] = kBase64Chars[(v >> 6) & 0x3f];
+    out[n++] = kBase64Chars[v & 0x3f];
+  }
+  if (i < size) {
+    const bool two = i + 1 < size;
+    const std::uint32_t v = (in[i] << 16) | (two ? in[i + 1] << 8 : 0);
+    out[n++] = kBase64Chars[(v >> 18) & 0x3f];
+    out[n++] = kBase64Chars[(v >> 12) & 0x3f];
+    out[n++] = two ? kBase64Chars[(v >> 6) & 0x3f] : '=';
+    out[n++] = '=';
+  }
+  writer.Raw(out, n);
+}
+
+class Deflater {
+ public:
+  Deflater() { ok_ = deflateInit(&stream_, Z_BEST_SPEED) == Z_OK; }
+  Deflater(const Deflater&) = delete;
+  Deflater& operator=(const Deflater&) = delete;
+
+  ~Deflater()
+  {
+    if (ok_) {
+      deflateEnd(&stream_);
+    }
+  }
+
+  bool ok() const noexcept { return ok_; }
+  z_stream& stream() noexcept { return stream_; }
+
+ private:
+  z_stream stream_{};
+  bool ok_;
+};
+
+class Inflater {
+ public:
+  Inflater() { ok_ = inflateInit(&stream_) == Z_OK; }
+  Inflater(const Inflater&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+
+  ~Inflater()
+  {
+    if (ok_) {
+      inflateEnd(&stream_);
+    }
+  }
+
+  bool ok() const noexcept { return ok_; }
+  z_stream& stream() noexcept { return stream_; }
+
+ private:
+  z_stream stream_{};
+  bool ok_;
+};
+}  // namespace
+
+bool cl::IsCompressedBlob(const char* data, std::size_t size)
+{
+  return size >= kPrefixSize &&
+         std::memcmp(data, kCompressedBlobPrefix, kPrefixSize) == 0;
+}
+
+std::size_t cl::CompressedBlobCapacity(std::size_t size)
+{
+  const std::size_t deflated = compressBound(static_cast<uLong>(size));
+  return 2 + kPrefixSize + (deflated + 2) / 3 * 4;
+}
+
+bool cl::WriteCompressedBlob(JsonWriter& writer, const char* data,
+                             std::size_t size)
+{
+  Deflater deflater;
+  if (!deflater.ok()) {
+    return false;
+  }
+  z_stream& zs = deflater.stream();
+
+  writer.Char('"');
+  writer.Raw(kCompressedBlobPrefix, kPrefixSize);
+
+  // deflate into chunk and encode it whenever it fills up, the base64 output
+  // goes straight into the writer's buffer
+  unsigned char chunk[kChunkSize];
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+  std::size_t remaining = size;
+  int ret = Z_OK;
+  zs.next_out = chunk;
+  zs.avail_out = kChunkSize;
+  while (ret != Z_STREAM_END && writer.ok()) {
+    if (zs.avail_in == 0 && remaining > 0) {
+      const std::size_t n = std::min(remaining, kChunkSize);
+      zs.next_in = const_cast<unsigned char*>(in);
+      zs.avail_in = static_cast<uInt>(n);
+      in += n;
+      remaining -= n;
+    }
+    ret = deflate(&zs, remaining == 0 ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_ERROR) {
+      return false;
+    }
+    if (zs.avail_out == 0 || ret == Z_STREAM_END) {
+      WriteBase64(writer, chunk, kChunkSize - zs.avail_out);
+      zs.next_out = chunk;
+      zs.avail_out = kChunkSize;
+    }
+  }
+
+  writer.Char('"');
+  return writer.ok();
+}
+
+tl::expected<std::string, std::string> cl::DecodeCompressedBlob(
+    const char* data, std::size_t size, std::size_t max_size)
+{
+  if (!IsCompressedBlob(data, size)) {
+    return tl::make_unexpected<std::string>("missing compressed blob prefix");
+  }
+  Inflater inflater;
+  if (!inflater.ok()) {
+    return tl::make_unexpected<std::string>("failed to initialize zlib");
+  }
+  z_stream& zs = inflater.stream();
+
+  // base64 decode a chunk at a time and inflate it into the result
+  const char* p = data + kPrefixSize;
+  const char* end = data + size;
+  std::uint32_t bits = 0;
+  int bitCount = 0;
+  unsigned char in[kChunkSize];
+  char out[kChunkSize];
+  std::string blob;
+  int ret = Z_OK;
+  while (ret != Z_STREAM_END) {
+    std::size_t n = 0;
+    while (p < end && *p != '=' && n < kChunkSize) {
+      const int v = Base64Value(*p++);
+      if (v < 0) {
+        return tl::make_unexpected<std::string>("invalid base64 in blob");
+      }
+      bits = (bits << 6) | static_cast<std::uint32_t>(v);
+      bitCount += 6;
+      if (bitCount >= 8) {
+        bitCount -= 8;
+        in[n++] = static_cast<unsigned char>(bits >> bitCount);
+      }
+    }
+    if (n == 0) {
+      return tl::make_unexpected<std::string>("truncated compressed blob");
+    }
+
+    zs.next_in = in;
+    zs.avail_in = static_cast<uInt>(n);
+    do {
+      zs.next_out = reinterpret_cast<unsigned char*>(out);
+      zs.avail_out = kChunkSize;
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        return tl::make_unexpected<std::string>("corrupt compressed blob");
+      }
+      const std::size_t produced = kChunkSize - zs.avail_out;
+      if (blob.size() + produced > max_size) {
+        return tl::make_unexpected<std::string>(
+            "compressed blob exceeds the size limit");
+      }
+      blob.append(out, produced);
+    } while (zs.avail_out == 0 && ret != Z_STREAM_END);
+  }
+
+  while (p < end && *p == '=') {
+    p++;
+  }
+  if (zs.avail_in != 0 || p != end) {
+    return tl::make_unexpected<std::string>(
+        "trailing data after compressed blob");
+  }
+  return blob;
+}
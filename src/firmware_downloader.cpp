@@ -0,0 +1,459 @@
+#include "firmware_downloader.h"
+
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <httplib.h>
+#include <openssl/evp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "publish_scheduler.h"
+#include "trace.h"
+
+namespace {
+struct Progress {
+  std::uint64_t total = 0;
+  std::uint64_t offset = 0;
+  /// @brief ETag or Last-Modified of the image the bytes came from
+  std::string validator;
+};
+
+Progress ReadProgress(const std::string& path)
+{
+  Progress progress;
+  std::ifstream file{path};
+  if (!(file >> progress.total >> progress.offset) ||
+      progress.offset > progress.total) {
+    return Progress{};
+  }
+  // Last-Modified contains spaces, so the validator takes its own line
+  std::getline(file >> std::ws, progress.validator);
+  return progress;
+}
+
+bool WriteProgress(const std::string& path, const Progress& progress)
+{
+  // write then rename, so a crash never leaves a half written checkpoint
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream file{tmp, std::ios::trunc};
+    if (!file.is_open()) {
+      return false;
+    }
+    file << progress.total << " " << progress.offset << "\n"
+         << progress.validator << "\n";
+    if (!file.good()) {
+      return false;
+    }
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Preallocated file mapped into memory. Synced ranges are dropped from the
+// mapping, so resident memory stays bounded by the checkpoint interval
+// instead of the image size.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { Close(); }
+
+  tl::expected<void, std::string> Open(const std::string& path,
+                                       std::uint64_t size)
+  {
+    Close();
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      return tl::make_unexpected<std::string>(
+          fmt::format("failed to open {}: {}", path, std::strerror(errno)));
+    }
+    // ftruncate alone would leave a sparse file that can fail with ENOSPC
+    // halfway through the download
+    if (::ftruncate(fd_, size) != 0 ||
+        (size > 0 && ::posix_fallocate(fd_, 0, size) != 0)) {
+      Close();
+      return tl::make_unexpected<std::string>(
+          fmt::format("failed to preallocate {} bytes for {}", size, path));
+    }
+    size_ = size;
+    if (size == 0) {
+      return {};
+    }
+    void* data =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+      Close();
+      return tl::make_unexpected<std::string>(
+          fmt::format("failed to map {}: {}", path, std::strerror(errno)));
+    }
+    data_ = static_cast<unsigned char*>(data);
+    return {};
+  }
+
+  /// @brief flush [from, to) to disk and drop it from the mapping
+  bool Sync(std::uint64_t from, std::uint64_t to)
+  {
+    if (!data_ || from >= to) {
+      return true;
+    }
+    static const std::uint64_t kPage = ::sysconf(_SC_PAGESIZE);
+    const std::uint64_t begin = from / kPage * kPage;
+    if (::msync(data_ + begin, to - begin, MS_SYNC) != 0) {
+      return false;
+    }
+    ::madvise(data_ + begin, to - begin, MADV_DONTNEED);
+    return true;
+  }
+
+  void Close()
+  {
+    if (data_) {
+      ::munmap(data_, size_);
+      data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+    size_ = 0;
+  }
+
+  bool is_open() const noexcept { return fd_ >= 0; }
+  unsigned char* data() noexcept { return data_; }
+  std::uint64_t size() const noexcept { return size_; }
+
+ private:
+  int fd_ = -1;
+  unsigned char* data_ = nullptr;
+  std::uint64_t size_ = 0;
+};
+
+class Digest {
+ public:
+  Digest() : ctx_(EVP_MD_CTX_new()) {}
+  Digest(const Digest&) = delete;
+  Digest& operator=(const Digest&) = delete;
+
+  ~Digest() { EVP_MD_CTX_free(ctx_); }
+
+  bool Init(const std::string& name)
+  {
+    const EVP_MD* md = EVP_get_digestbyname(name.c_str());
+    return md && EVP_DigestInit_ex(ctx_, md, nullptr) == 1;
+  }
+
+  void Update(const void* data, std::size_t size)
+  {
+    EVP_DigestUpdate(ctx_, data, size);
+  }
+
+  std::string HexFinal()
+  {
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    EVP_DigestFinal_ex(ctx_, md, &size);
+    std::string hex;
+    for (unsigned int i = 0; i < size; i++) {
+      hex += fmt::format("{:02x}", md[i]);
+    }
+    return hex;
+  }
+
+ private:
+  EVP_MD_CTX* ctx_;
+};
+
+/// @brief validator for If-Range: a strong ETag, else Last-Modified. Weak
+/// ETags cannot be used with If-Range
+std::string RangeValidator(const httplib::Response& response)
+{
+  const std::string etag = response.get_header_value("ETag");
+  if (!etag.empty() && etag.compare(0, 2, "W/") != 0) {
+    return etag;
+  }
+  return response.get_header_value("Last-Modified");
+}
+
+/// @brief first byte and total size from "Content-Range: bytes
+/// 100-999/1000", false when the header does not have this form
+bool ParseContentRange(const std::string& range, std::uint64_t* start,
+                       std::uint64_t* total)
+{
+  static const char kUnit[] = "bytes ";
+  if (range.compare(0, sizeof(kUnit) - 1, kUnit) != 0) {
+    return false;
+  }
+  const char* p = range.c_str() + sizeof(kUnit) - 1;
+  char* end = nullptr;
+  errno = 0;
+  *start = std::strtoull(p, &end, 10);
+  if (end == p || *end != '-' || errno == ERANGE) {
+    return false;
+  }
+  p = end + 1;
+  const std::uint64_t last = std::strtoull(p, &end, 10);
+  if (end == p || *end != '/' || last < *start || errno == ERANGE) {
+    return false;
+  }
+  p = end + 1;
+  *total = std::strtoull(p, &end, 10);
+  return end != p && *end == '\0' && errno != ERANGE && last < *total;
+}
+
+std::int64_t SteadyNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
+cl::FirmwareDownloader::FirmwareDownloader(const Options& options)
+    : options_(options), logger_{(LogLevel)CL_ONENET_LOG_LEVEL}
+{
+}
+
+void cl::FirmwareDownloader::Cancel()
+{
+  cancelled_ = true;
+}
+
+tl::expected<cl::FirmwareDownloader::Result, std::string>
+cl::FirmwareDownloader::Download(const std::string& url,
+                                 const std::string& path,
+                                 const std::string& expectedDigest)
+{
+  CL_TRACE_SPAN("firmware_download");
+
+  // split "https://host:port/path?query" into client base and request target
+  const auto scheme = url.find("://");
+  if (scheme == std::string::npos) {
+    return tl::make_unexpected<std::string>("invalid url " + url);
+  }
+  const auto slash = url.find('/', scheme + 3);
+  const std::string base = url.substr(0, slash);
+  const std::string target =
+      slash == std::string::npos ? "/" : url.substr(slash);
+
+  httplib::Client client{base};
+  client.set_follow_location(true);
+  if (!options_.ca_cert_path.empty()) {
+    client.set_ca_cert_path(options_.ca_cert_path);
+  }
+
+  const std::string progressPath = path + ".progress";
+  Progress progress = ReadProgress(progressPath);
+  MappedFile file;
+  Digest digest;
+  if (!digest.Init(options_.digest)) {
+    return tl::make_unexpected<std::string>("unsupported digest " +
+                                            options_.digest);
+  }
+
+  // rehash the part downloaded by an earlier run, window by window. Without
+  // a validator the server cannot tell whether the image changed since, so
+  // such a checkpoint is not resumed
+  struct stat st;
+  if (progress.offset > 0 && !progress.validator.empty() &&
+      ::stat(path.c_str(), &st) == 0 &&
+      static_cast<std::uint64_t>(st.st_size) == progress.total &&
+      file.Open(path, progress.total).has_value()) {
+    std::uint64_t hashed = 0;
+    while (hashed < progress.offset) {
+      const auto n = std::min<std::uint64_t>(options_.checkpoint_interval,
+                                             progress.offset - hashed);
+      digest.Update(file.data() + hashed, n);
+      file.Sync(hashed, hashed + n);
+      hashed += n;
+    }
+    logger_.Info("resume firmware download at {}/{}", progress.offset,
+                 progress.total);
+  }
+  else {
+    progress = Progress{};
+  }
+
+  const std::uint64_t resumedFrom = progress.offset;
+  const auto start = std::chrono::steady_clock::now();
+  cl::TokenBucket bandwidth{static_cast<double>(options_.rate_limit),
+                            static_cast<double>(options_.rate_limit)};
+  std::uint64_t checkpoint = progress.offset;
+  bool complete = false;
+
+  for (int attempt = 0; attempt <= options_.max_retries && !complete;
+       attempt++) {
+    std::string fatal;
+    bool restart = false;
+    httplib::Headers headers;
+    if (progress.offset > 0 && !progress.validator.empty()) {
+      // the server answers 200 with the whole image if it changed
+      headers.emplace("Range", fmt::format("bytes={}-", progress.offset));
+      headers.emplace("If-Range", progress.validator);
+    }
+    else if (progress.offset > 0) {
+      logger_.Warn("server sent no ETag or Last-Modified, restart download");
+      digest.Init(options_.digest);
+      progress.offset = 0;
+      checkpoint = 0;
+    }
+
+    auto res = client.Get(
+        target, headers,
+        [&](const httplib::Response& response) {
+          std::uint64_t total = 0;
+          if (response.status == 206 && progress.offset > 0) {
+            std::uint64_t start = 0;
+            if (!ParseContentRange(response.get_header_value("Content-Range"),
+                                   &start, &total) ||
+                start != progress.offset) {
+              // the body would not continue the checkpoint
+              progress = Progress{};
+              checkpoint = 0;
+              restart = true;
+              return false;
+            }
+            const std::string validator = RangeValidator(response);
+            if (total != progress.total ||
+                (!validator.empty() && validator != progress.validator)) {
+              // the checkpoint is useless now, the next run starts over
+              progress = Progress{};
+              checkpoint = 0;
+              fatal = "firmware image changed on the server";
+              return false;
+            }
+          }
+          else if (response.status == 200) {
+            // a fresh download, no range support, or the image changed
+            // since the checkpoint: start over
+            if (progress.offset > 0) {
+              logger_.Warn(
+                  "server sent the whole image for a range request, restart "
+                  "download");
+              digest.Init(options_.digest);
+            }
+            progress.offset = 0;
+            progress.validator = RangeValidator(response);
+            checkpoint = 0;
+            total = std::strtoull(
+                response.get_header_value("Content-Length").c_str(), nullptr,
+                10);
+            if (total == 0 && !response.has_header("Content-Length")) {
+              fatal = "server did not report the firmware size";
+              return false;
+            }
+          }
+          else {
+            fatal = fmt::format("unexpected http status {}", response.status);
+            return false;
+          }
+
+          if (!file.is_open() || file.size() != total) {
+            auto opened = file.Open(path, total);
+            if (!opened.has_value()) {
+              fatal = opened.error();
+              return false;
+            }
+          }
+          progress.total = total;
+          return true;
+        },
+        [&](const char* data, std::size_t size) {
+          if (cancelled_) {
+            fatal = "firmware download cancelled";
+            return false;
+          }
+          if (progress.offset + size > progress.total) {
+            fatal = "server sent more data than announced";
+            return false;
+          }
+          std::memcpy(file.data() + progress.offset, data, size);
+          digest.Update(data, size);
+          progress.offset += size;
+
+          if (progress.offset - checkpoint >= options_.checkpoint_interval) {
+            if (!file.Sync(checkpoint, progress.offset) ||
+                !WriteProgress(progressPath, progress)) {
+              fatal = "failed to checkpoint firmware download";
+              return false;
+            }
+            checkpoint = progress.offset;
+          }
+
+          if (options_.rate_limit > 0) {
+            const auto wait = bandwidth.Consume(size, SteadyNowNs());
+            if (wait > 0) {
+              std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+            }
+          }
+          return true;
+        });
+
+    if (restart) {
+      // without a Range header the next attempt gets a 200, so this happens
+      // at most once and does not use up a retry
+      logger_.Warn("server answered the range request at the wrong offset, "
+                   "restart download");
+      digest.Init(options_.digest);
+      WriteProgress(progressPath, progress);
+      attempt--;
+      continue;
+    }
+    if (!fatal.empty()) {
+      file.Sync(checkpoint, progress.offset);
+      WriteProgress(progressPath, progress);
+      return tl::make_unexpected(fatal);
+    }
+    complete = res && file.is_open() && progress.offset == progress.total;
+    if (!complete) {
+      // keep what arrived and retry from there
+      file.Sync(checkpoint, progress.offset);
+      checkpoint = progress.offset;
+      WriteProgress(progressPath, progress);
+      logger_.Warn("firmware download interrupted at {}/{}: {}",
+                   progress.offset, progress.total,
+                   res ? "incomplete body" : httplib::to_string(res.error()));
+    }
+  }
+
+  if (!complete) {
+    return tl::make_unexpected<std::string>(
+        fmt::format("firmware download failed after {} retries",
+                    options_.max_retries));
+  }
+
+  if (!file.Sync(checkpoint, progress.offset)) {
+    return tl::make_unexpected<std::string>("failed to flush firmware image");
+  }
+  file.Close();
+  std::remove(progressPath.c_str());
+
+  Result result;
+  result.size = progress.total;
+  result.resumed_from = resumedFrom;
+  result.digest = digest.HexFinal();
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::string expected = expectedDigest;
+  std::transform(expected.begin(), expected.end(), expected.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (!expected.empty() && expected != result.digest) {
+    return tl::make_unexpected<std::string>(
+        fmt::format("firmware digest mismatch, expected {}, got {}",
+                    expectedDigest, result.digest));
+  }
+  return result;
+}
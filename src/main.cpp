@@ -1,4 +1,5 @@
 #include <fmt/base.h>
+#include <sys/resource.h>
 
 #include <atomic>
 #include <condition_variable>
@@ -6,22 +7,31 @@
 #include <iostream>
 #include <mutex>
 #include <sstream>
+#include <thread>
 
 #include "base64_openssl.h"
 #include "command_line_parser.h"
+#include "firmware_downloader.h"
 #include "onenet_client.h"
+#include "trace.h"
 #include "url_util_httplib.h"
 
 static std::mutex g_shutdown_mu;
 static std::condition_variable g_shutdown_cv;
 static std::atomic<bool> g_shutdown_request{false};
+static std::atomic<bool> g_trace_dump_request{false};
 
 void SignalHandler(int signalNum)
 {
-  if (signalNum != SIGINT && signalNum != SIGTERM) {
+  if (signalNum == SIGUSR1) {
+    g_trace_dump_request = true;
+  }
+  else if (signalNum == SIGINT || signalNum == SIGTERM) {
+    g_shutdown_request = true;
+  }
+  else {
     return;
   }
-  g_shutdown_request = true;
   try {
     g_shutdown_cv.notify_one();
   } catch (std::exception& e) {
@@ -37,6 +47,29 @@ int main(int argc, const char* const argv[])
   argparser.AddMandatory<std::string>("d,device-name", "device name");
   argparser.AddMandatory<std::string>("t,device-secret", "device secret");
   argparser.AddMandatory<bool>("a,device-auth", "device level auth", "true");
+  argparser.AddOptionalString(
+      "trace-file",
+      "enable span tracing, chrome trace json is written here on SIGUSR1 "
+      "and on exit");
+  argparser.AddOptionalString(
+      "thing-model",
+      "thing model json, outgoing properties are validated against it");
+  argparser.AddOptionalString(
+      "record", "record the session's mqtt traffic for onenet-replay");
+  argparser.AddOptionalString(
+      "receive-mode",
+      "callback: dispatch inbound messages on the mqtt thread, queue: hand "
+      "them to the connection thread",
+      "callback");
+  argparser.AddOptionalString("firmware-url",
+                              "download a firmware image from this url");
+  argparser.AddOptionalString("firmware-file", "where to store the firmware",
+                              "firmware.bin");
+  argparser.AddOptionalString("firmware-sha256",
+                              "expected sha256 of the firmware image");
+  argparser.AddOptional<int>("firmware-rate",
+                             "firmware download limit in KiB/s, 0 = unlimited",
+                             0);
   auto opts = argparser.Parse(argc, argv);
 
   auto pid = opts["product-id"].as<std::string>();
@@ -44,30 +77,127 @@ int main(int argc, const char* const argv[])
   auto dn = opts["device-name"].as<std::string>();
   auto ds = opts["device-secret"].as<std::string>();
   auto da = opts["device-auth"].as<bool>();
+  auto traceFile = opts["trace-file"].as<std::string>();
+  auto thingModelFile = opts["thing-model"].as<std::string>();
+  auto firmwareUrl = opts["firmware-url"].as<std::string>();
+  auto firmwareFile = opts["firmware-file"].as<std::string>();
+  auto firmwareDigest = opts["firmware-sha256"].as<std::string>();
+  auto firmwareRate = opts["firmware-rate"].as<int>();
+  auto recordFile = opts["record"].as<std::string>();
+  auto receiveMode = opts["receive-mode"].as<std::string>();
   logger.Info(
       "product id = {}, product secret = {}, device name = {}, device secret = "
       "{}",
       pid, ps, dn, ds);
 
   if (std::signal(SIGINT, SignalHandler) == SIG_ERR ||
-      std::signal(SIGTERM, SignalHandler) == SIG_ERR) {
+      std::signal(SIGTERM, SignalHandler) == SIG_ERR ||
+      std::signal(SIGUSR1, SignalHandler) == SIG_ERR) {
     logger.Error("failed to register signal handler");
     return 1;
   }
 
+  auto dumpTrace = [&logger, &traceFile]() {
+    if (cl::Tracer::WriteChromeTrace(traceFile)) {
+      logger.Info("trace written to {}", traceFile);
+    }
+    else {
+      logger.Error("failed to write trace to {}", traceFile);
+    }
+  };
+  cl::Tracer::Enable(!traceFile.empty());
+
   std::shared_ptr<cl::Base64> base64 = std::make_shared<cl::Base64Openssl>();
   std::shared_ptr<cl::UrlUtil> urlUtil = std::make_shared<cl::UrlUtilHttplib>();
 
   cl::OneNetClient client{da, pid, ps, dn, ds, base64, urlUtil};
+  if (!recordFile.empty()) {
+    auto recorder = cl::TrafficRecorder::Open(recordFile);
+    if (!recorder.has_value()) {
+      logger.Error("failed to record traffic: {}", recorder.error());
+      return 1;
+    }
+    client.SetTrafficRecorder(std::move(recorder.value()));
+  }
+  if (receiveMode == "queue") {
+    client.SetReceiveMode(cl::OneNetClient::ReceiveMode::kQueue);
+  }
+  else if (receiveMode != "callback") {
+    logger.Error("unknown receive mode {}", receiveMode);
+    return 1;
+  }
+  if (!thingModelFile.empty()) {
+    auto thingModel = cl::ThingModelIndex::Load(thingModelFile);
+    if (!thingModel.has_value()) {
+      logger.Error("failed to load thing model: {}", thingModel.error());
+      return 1;
+    }
+    logger.Info("loaded {} properties from thing model",
+                thingModel.value().size());
+    client.SetThingModel(std::make_shared<const cl::ThingModelIndex>(
+        std::move(thingModel.value())));
+  }
   client.Connect();
 
+  cl::FirmwareDownloader::Options downloadOpts;
+  downloadOpts.rate_limit = static_cast<std::size_t>(firmwareRate) * 1024;
+  cl::FirmwareDownloader downloader{downloadOpts};
+  std::thread downloadThread;
+  if (!firmwareUrl.empty()) {
+    downloadThread = std::thread([&]() {
+      auto result =
+          downloader.Download(firmwareUrl, firmwareFile, firmwareDigest);
+      if (!result.has_value()) {
+        logger.Error("firmware download failed: {}", result.error());
+        return;
+      }
+      const auto& r = result.value();
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      logger.Info(
+          "firmware downloaded, size = {}, resumed from = {}, sha256 = {}, "
+          "throughput = {:.1f} KiB/s, peak rss = {} KiB",
+          r.size, r.resumed_from, r.digest,
+          r.seconds > 0 ? (r.size - r.resumed_from) / 1024.0 / r.seconds : 0.0,
+          usage.ru_maxrss);
+    });
+  }
+
   logger.Info("Press ctrl+c to quit");
-  {
-    std::unique_lock<std::mutex> lock{g_shutdown_mu};
-    g_shutdown_cv.wait(lock, [] { return g_shutdown_request.load(); });
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{g_shutdown_mu};
+      g_shutdown_cv.wait(lock, [] {
+        return g_shutdown_request.load() || g_trace_dump_request.load();
+      });
+    }
+    if (g_trace_dump_request.exchange(false) && cl::Tracer::IsEnabled()) {
+      dumpTrace();
+    }
+    if (g_shutdown_request) {
+      break;
+    }
   }
 
   logger.Info("shutdown client");
+  if (downloadThread.joinable()) {
+    downloader.Cancel();
+    downloadThread.join();
+  }
+  client.Disconnect();
+  for (int i = 1; i < static_cast<int>(cl::PropertyCheck::kCount); i++) {
+    const auto reason = static_cast<cl::PropertyCheck>(i);
+    if (auto count = client.GetRejectionCount(reason)) {
+      logger.Info("rejected properties, reason = {}, count = {}",
+                  cl::PropertyCheckToString(reason), count);
+    }
+  }
+  if (auto dropped = client.GetDroppedMessageCount()) {
+    logger.Warn("dropped {} messages on a full receive queue", dropped);
+  }
+  if (cl::Tracer::IsEnabled()) {
+    dumpTrace();
+  }
 
   return 0;
 }
@@ -5,11 +5,15 @@
 #include <openssl/hmac.h>
 #include <openssl/sha.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <nlohmann/json.hpp>
 #include <thread>
 
+#include "trace.h"
+
 const std::string cl::OneNetClient::kServerUrl{
     "mqtts://mqttstls.heclouds.com:8883"};
 const std::string cl::OneNetClient::kCaCert = R"(-----BEGIN CERTIFICATE-----
@@ -34,6 +38,37 @@ WzdhzTYwVkxBaU+xf/2w
 -----END CERTIFICATE-----)";
 const std::string cl::OneNetClient::kSigningMethod = "sha1";
 const std::string cl::OneNetClient::kSigningAlgVersion = "2018-10-31";
+const std::chrono::milliseconds cl::OneNetClient::kFlushInterval{50};
+
+namespace {
+std::int64_t SteadyNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// property/set and service invoke reply codes
+const int kCodeOk = 200;
+const int kCodeBadRequest = 400;
+const int kCodeNotFound = 404;
+const int kCodeBusy = 503;
+const int kCodeTimeout = 504;
+
+const char kInvokeSuffix[] = "/invoke";
+
+/// @brief time the broker gets to acknowledge a disconnect
+const int kDisconnectTimeoutMs = 3000;
+
+/// @brief queued messages published per scheduler lock
+const std::size_t kFlushBatch = 32;
+
+#if CL_ONENET_LITE
+/// @brief fits "$sys/{pid}/{device}/thing/property/set_reply" for OneNET's
+/// longest product id and device name
+const std::size_t kTopicReserve = 128;
+#endif
+}  // namespace
 
 cl::OneNetClient::OneNetClient(bool deviceLevelAuth, std::string productId,
                                std::string productSecret,
@@ -50,6 +85,46 @@ cl::OneNetClient::OneNetClient(bool deviceLevelAuth, std::string productId,
       base64_(base64),
       urlUtil_(urlUtil)
 {
+  PublishScheduler::Options limits;
+  limits.capacity = CL_ONENET_PUBLISH_QUEUE_CAPACITY;
+#if CL_ONENET_LITE
+  // size the queue up front, throttled publishes must not allocate
+  limits.topic_reserve = kTopicReserve;
+  limits.payload_reserve = CL_ONENET_PAYLOAD_CAPACITY;
+#endif
+  SetPublishLimits(limits);
+
+  const char* subscriptions[] = {
+      "thing/property/post/reply",
+      "thing/property/set",
+      "thing/property/desired/get/reply",
+      "thing/property/desired/delete/reply",
+      "thing/property/get",
+      "thing/event/post/reply",
+      "thing/service/+/invoke",
+      "thing/sub/property/get",
+      "thing/sub/property/set",
+  };
+  static_assert(sizeof(subscriptions) / sizeof(subscriptions[0]) <=
+                    CL_ONENET_MAX_TOPICS,
+                "CL_ONENET_MAX_TOPICS is too small for the subscribed topics");
+  for (const char* suffix : subscriptions) {
+    subscribe_topics_.push_back(
+        fmt::format("$sys/{}/{}/{}", product_id_, device_name_, suffix));
+  }
+  property_post_topic_ = fmt::format("$sys/{}/{}/thing/property/post",
+                                     product_id_, device_name_);
+  property_set_topic_ = fmt::format("$sys/{}/{}/thing/property/set",
+                                    product_id_, device_name_);
+  property_set_reply_topic_ = fmt::format(
+      "$sys/{}/{}/thing/property/set_reply", product_id_, device_name_);
+  service_topic_prefix_ =
+      fmt::format("$sys/{}/{}/thing/service/", product_id_, device_name_);
+}
+
+cl::OneNetClient::~OneNetClient()
+{
+  Disconnect();
 }
 
 void cl::OneNetClient::Connect()
@@ -59,31 +134,738 @@ void cl::OneNetClient::Connect()
     return;
   }
 
+  {
+    std::lock_guard<std::mutex> lock{receive_mu_};
+    stop_requested_ = false;
+  }
   worker_thread_.reset(new std::thread(&OneNetClient::RunLoop, this));
 }
 
 void cl::OneNetClient::Disconnect()
 {
   if (worker_thread_ && worker_thread_->joinable()) {
-    if (mqtt_client_.is_connected()) {
-      logger_.Info("request to disconnect");
-      mqtt_client_.stop_consuming();
-      mqtt_client_.disconnect(3000);
+    {
+      std::lock_guard<std::mutex> lock{receive_mu_};
+      stop_requested_ = true;
     }
+    receive_cv_.notify_one();
+    logger_.Info("request to disconnect");
+    // RunLoop disconnects before it returns
     worker_thread_->join();
     worker_thread_.reset();
     logger_.Info("disconnected");
   }
 }
 
-void cl::OneNetClient::UploadProperties(
+namespace {
+template <typename T>
+bool AnyAs(cl::Any& value, T* out)
+{
+  T* ptr = cl::any_cast<T>(&value);
+  if (!ptr) {
+    return false;
+  }
+  *out = *ptr;
+  return true;
+}
+
+bool ToPropertyValue(cl::Any& value, cl::PropertyValue* out)
+{
+  bool b;
+  int i;
+  long l;
+  long long ll;
+  unsigned int u;
+  unsigned long ul;
+  unsigned long long ull;
+  float f;
+  double d;
+  if (AnyAs(value, &b)) {
+    *out = cl::PropertyValue::Bool(b);
+  }
+  else if (AnyAs(value, &i)) {
+    *out = cl::PropertyValue::Int(i);
+  }
+  else if (AnyAs(value, &l)) {
+    *out = cl::PropertyValue::Int(l);
+  }
+  else if (AnyAs(value, &ll)) {
+    *out = cl::PropertyValue::Int(ll);
+  }
+  else if (AnyAs(value, &u)) {
+    *out = cl::PropertyValue::Int(u);
+  }
+  // uint64_t is one of the two, values above INT64_MAX do not fit
+  else if (AnyAs(value, &ul)) {
+    if (ul > static_cast<unsigned long>(INT64_MAX)) {
+      return false;
+    }
+    *out = cl::PropertyValue::Int(static_cast<std::int64_t>(ul));
+  }
+  else if (AnyAs(value, &ull)) {
+    if (ull > static_cast<unsigned long long>(INT64_MAX)) {
+      return false;
+    }
+    *out = cl::PropertyValue::Int(static_cast<std::int64_t>(ull));
+  }
+  else if (AnyAs(value, &f)) {
+    *out = cl::PropertyValue::Float(f);
+  }
+  else if (AnyAs(value, &d)) {
+    *out = cl::PropertyValue::Double(d);
+  }
+  else if (auto s = cl::any_cast<std::string>(&value)) {
+    *out = cl::PropertyValue::String(s->data(), s->size());
+  }
+  else if (auto cs = cl::any_cast<const char*>(&value)) {
+    *out = cl::PropertyValue::String(*cs);
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+tl::expected<void, std::string> cl::OneNetClient::UploadProperties(
     std::map<std::string, cl::Any> properties)
 {
+  PropertyBatch batch;
+  for (auto& kv : properties) {
+    Property property{kv.first.c_str(), PropertyValue::Bool(false)};
+    if (!ToPropertyValue(kv.second, &property.value)) {
+      return tl::make_unexpected<std::string>(
+          fmt::format("unsupported value type or range for property {}",
+                      kv.first));
+    }
+    if (!batch.push_back(property)) {
+      return tl::make_unexpected<std::string>(
+          fmt::format("too many properties, max = {}", batch.capacity()));
+    }
+  }
+  return UploadProperties(batch);
+}
+
+tl::expected<void, std::string> cl::OneNetClient::Validate(
+    const Property& property)
+{
+  const auto check = thing_model_->Check(property);
+  // the length limit applies to the sent string, which for a compressed
+  // property is only known once it is encoded, see ValidateEncodedLength
+  if (check == PropertyCheck::kOk ||
+      (check == PropertyCheck::kStringTooLong &&
+       IsCompressedProperty(property.id))) {
+    return {};
+  }
+  rejections_[static_cast<int>(check)].fetch_add(1, std::memory_order_relaxed);
+  return tl::make_unexpected<std::string>(fmt::format(
+      "property {} rejected: {}", property.id, PropertyCheckToString(check)));
+}
+
+tl::expected<void, std::string> cl::OneNetClient::ValidateEncodedLength(
+    const char* id, std::size_t size)
+{
+  const std::size_t maxLength = thing_model_ ? thing_model_->MaxLength(id) : 0;
+  if (maxLength == 0 || size <= maxLength) {
+    return {};
+  }
+  rejections_[static_cast<int>(PropertyCheck::kStringTooLong)].fetch_add(
+      1, std::memory_order_relaxed);
+  return tl::make_unexpected<std::string>(
+      fmt::format("property {} rejected: {}, {} bytes encoded, max = {}", id,
+                  PropertyCheckToString(PropertyCheck::kStringTooLong), size,
+                  maxLength));
+}
+
+tl::expected<void, std::string> cl::OneNetClient::UploadProperties(
+    const PropertyBatch& properties, PublishPriority priority,
+    std::uint64_t coalesceKey)
+{
+  if (thing_model_) {
+    CL_TRACE_SPAN("validate");
+    for (const auto& property : properties) {
+      auto valid = Validate(property);
+      if (!valid.has_value()) {
+        return valid;
+      }
+    }
+  }
+
+  // a compressed blob does not fit the fixed payload buffer, posts carrying
+  // one are written into a heap buffer sized for their blobs instead
+  std::size_t blobCapacity = 0;
+  for (const auto& property : properties) {
+    if (property.value.type != PropertyValue::Type::kString ||
+        !IsCompressedProperty(property.id)) {
+      continue;
+    }
+    if (property.value.s.size > CL_ONENET_MAX_BLOB_SIZE) {
+      return tl::make_unexpected<std::string>(
+          fmt::format("property {} is {} bytes, max blob size = {}",
+                      property.id, property.value.s.size,
+                      CL_ONENET_MAX_BLOB_SIZE));
+    }
+    blobCapacity += CompressedBlobCapacity(property.value.s.size);
+  }
+  char payload[CL_ONENET_PAYLOAD_CAPACITY];
+  std::vector<char> blobPayload;
+  if (blobCapacity > 0) {
+    blobPayload.resize(sizeof(payload) + blobCapacity);
+  }
+  JsonWriter writer = blobPayload.empty()
+                          ? JsonWriter{payload, sizeof(payload)}
+                          : JsonWriter{blobPayload.data(), blobPayload.size()};
+  BeginRequest(writer);
+  bool first = true;
+  for (const auto& property : properties) {
+    if (!first) {
+      writer.Char(',');
+    }
+    first = false;
+    writer.String(property.id);
+    writer.Raw(":{\"value\":");
+    const auto& value = property.value;
+    switch (value.type) {
+      case PropertyValue::Type::kBool:
+        writer.Bool(value.b);
+        break;
+      case PropertyValue::Type::kInt:
+        writer.Int(value.i);
+        break;
+      case PropertyValue::Type::kFloat:
+        writer.Float(value.f);
+        break;
+      case PropertyValue::Type::kDouble:
+        writer.Double(value.d);
+        break;
+      case PropertyValue::Type::kString:
+        if (!IsCompressedProperty(property.id)) {
+          writer.String(value.s.data, value.s.size);
+        }
+        else {
+          const std::size_t begin = writer.size();
+          if (!WriteCompressedBlob(writer, value.s.data, value.s.size)) {
+            if (writer.ok()) {
+              return tl::make_unexpected<std::string>(
+                  fmt::format("failed to compress property {}", property.id));
+            }
+            break;
+          }
+          // the written envelope is quoted, the limit counts its content
+          auto valid =
+              ValidateEncodedLength(property.id, writer.size() - begin - 2);
+          if (!valid.has_value()) {
+            return valid;
+          }
+        }
+        break;
+    }
+    writer.Char('}');
+  }
+  return FinishRequest(writer, property_post_topic_, priority, coalesceKey);
+}
+
+void cl::OneNetClient::SetPropertySetHandler(PropertySetHandler handler)
+{
+  property_set_handler_ = std::move(handler);
+}
+
+void cl::OneNetClient::SetPropertyEncoding(const std::string& identifier,
+                                           PropertyEncoding encoding)
+{
+  auto it = std::lower_bound(compressed_properties_.begin(),
+                             compressed_properties_.end(), identifier);
+  const bool found = it != compressed_properties_.end() && *it == identifier;
+  if (encoding == PropertyEncoding::kCompressed && !found) {
+    compressed_properties_.insert(it, identifier);
+  }
+  else if (encoding == PropertyEncoding::kPlain && found) {
+    compressed_properties_.erase(it);
+  }
+}
+
+bool cl::OneNetClient::IsCompressedProperty(const char* identifier) const
+{
+  if (compressed_properties_.empty()) {
+    return false;
+  }
+  // compare against the c string directly, uploads must not allocate
+  auto it = std::lower_bound(
+      compressed_properties_.begin(), compressed_properties_.end(),
+      identifier, [](const std::string& lhs, const char* rhs) {
+        return std::strcmp(lhs.c_str(), rhs) < 0;
+      });
+  return it != compressed_properties_.end() &&
+         std::strcmp(it->c_str(), identifier) == 0;
+}
+
+bool cl::OneNetClient::DecodeCompressedProperties(nlohmann::json& params)
+{
+  if (compressed_properties_.empty() || !params.is_object()) {
+    return true;
+  }
+  for (const auto& identifier : compressed_properties_) {
+    auto it = params.find(identifier);
+    if (it == params.end() || !it->is_string()) {
+      continue;
+    }
+    const auto& value = it->get_ref<const std::string&>();
+    if (!IsCompressedBlob(value.data(), value.size())) {
+      continue;
+    }
+    auto blob = DecodeCompressedBlob(value.data(), value.size(),
+                                     CL_ONENET_MAX_BLOB_SIZE);
+    if (!blob.has_value()) {
+      logger_.Warn("failed to decode property {}: {}", identifier,
+                   blob.error());
+      return false;
+    }
+    *it = std::move(blob.value());
+  }
+  return true;
+}
+
+void cl::OneNetClient::RegisterService(const std::string& identifier,
+                                       ServiceHandler handler,
+                                       const ServiceOptions& options)
+{
+  if (!service_executor_) {
+    service_executor_.reset(new WorkStealingExecutor(
+        CL_ONENET_SERVICE_WORKERS, CL_ONENET_SERVICE_QUEUE_CAPACITY));
+  }
+  Service service;
+  service.handler = std::move(handler);
+  service.options = options;
+  service.in_flight = std::make_shared<std::atomic<int>>(0);
+  services_[identifier] = std::move(service);
+}
+
+void cl::OneNetClient::HandleServiceInvoke(const std::string& topic,
+                                           const char* payload,
+                                           std::size_t size)
+{
+  // $sys/{pid}/{device}/thing/service/{identifier}/invoke
+  const std::size_t suffixSize = sizeof(kInvokeSuffix) - 1;
+  if (topic.size() <= service_topic_prefix_.size() + suffixSize ||
+      topic.compare(topic.size() - suffixSize, suffixSize, kInvokeSuffix) !=
+          0) {
+    return;
+  }
+  const std::string identifier =
+      topic.substr(service_topic_prefix_.size(),
+                   topic.size() - service_topic_prefix_.size() - suffixSize);
+
+  auto request = nlohmann::json::parse(payload, payload + size, nullptr, false);
+  if (request.is_discarded() || !request.contains("id") ||
+      !request["id"].is_string()) {
+    logger_.Warn("invalid service invoke request: {}",
+                 fmt::string_view(payload, size));
+    return;
+  }
+
+  auto invocation = std::make_shared<Invocation>();
+  invocation->id = request["id"].get<std::string>();
+  invocation->reply_topic = topic + "_reply";
+
+  auto it = services_.find(identifier);
+  if (it == services_.end()) {
+    logger_.Warn("service {} not registered", identifier);
+    ReplyService(invocation, kCodeNotFound, nlohmann::json::object());
+    return;
+  }
+
+  const Service& service = it->second;
+  auto inFlight = service.in_flight;
+  if (inFlight->fetch_add(1) >= service.options.max_concurrency) {
+    inFlight->fetch_sub(1);
+    logger_.Warn("service {} busy, reject invocation {}", identifier,
+                 invocation->id);
+    ReplyService(invocation, kCodeBusy, nlohmann::json::object());
+    return;
+  }
+
+  invocation->deadline_ns =
+      SteadyNowNs() +
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          service.options.timeout)
+          .count();
+  {
+    std::lock_guard<std::mutex> lock{invocations_mu_};
+    invocations_.push_back(invocation);
+  }
+
+  auto handler = service.handler;
+  auto params = request.contains("params") ? request["params"]
+                                           : nlohmann::json::object();
+  auto task = [this, handler, params, invocation, inFlight]() {
+    // queued past its deadline: the caller already got, or is about to get,
+    // a timeout, so the handler must not act on the request anymore
+    if (invocation->replied || SteadyNowNs() >= invocation->deadline_ns) {
+      inFlight->fetch_sub(1);
+      logger_.Warn("service invocation {} expired in the queue, skip it",
+                   invocation->id);
+      ReplyService(invocation, kCodeTimeout, nlohmann::json::object());
+      return;
+    }
+    nlohmann::json data = nlohmann::json::object();
+    int code;
+    {
+      CL_TRACE_SPAN("service_handler");
+      try {
+        code = handler(params, &data);
+      } catch (std::exception& e) {
+        logger_.Error("service handler failed: {}", e.what());
+        code = 500;
+      } catch (...) {
+        // anything escaping here would end the executor thread
+        logger_.Error("service handler failed with an unknown exception");
+        data = nlohmann::json::object();
+        code = 500;
+      }
+    }
+    // a handler that outlived its timeout still holds a concurrency slot
+    inFlight->fetch_sub(1);
+    ReplyService(invocation, code, data);
+  };
+  if (!service_executor_->Submit(task)) {
+    inFlight->fetch_sub(1);
+    logger_.Warn("service executor full, reject invocation {}",
+                 invocation->id);
+    ReplyService(invocation, kCodeBusy, nlohmann::json::object());
+  }
+}
+
+void cl::OneNetClient::ReplyService(
+    const std::shared_ptr<Invocation>& invocation, int code,
+    const nlohmann::json& data)
+{
+  if (invocation->replied.exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{invocations_mu_};
+    auto it = std::find(invocations_.begin(), invocations_.end(), invocation);
+    if (it != invocations_.end()) {
+      invocations_.erase(it);
+    }
+  }
+
+  // {"id":"<request id>","code":200,"msg":"success","data":{...}}
+  nlohmann::json reply = {{"id", invocation->id},
+                          {"code", code},
+                          {"msg", code == kCodeOk ? "success" : "failed"},
+                          {"data", data}};
+  const auto payload = reply.dump();
+  auto published = Publish(invocation->reply_topic, payload.data(),
+                           payload.size(), PublishPriority::kReply);
+  if (!published.has_value()) {
+    logger_.Error("failed to reply service invocation {}: {}",
+                  invocation->id, published.error());
+  }
+}
+
+void cl::OneNetClient::ExpireServiceInvocations(std::int64_t now_ns)
+{
+  std::vector<std::shared_ptr<Invocation>> expired;
+  {
+    std::lock_guard<std::mutex> lock{invocations_mu_};
+    for (const auto& invocation : invocations_) {
+      if (invocation->deadline_ns <= now_ns) {
+        expired.push_back(invocation);
+      }
+    }
+  }
+  for (const auto& invocation : expired) {
+    logger_.Warn("service invocation {} timed out", invocation->id);
+    ReplyService(invocation, kCodeTimeout, nlohmann::json::object());
+  }
+}
+
+void cl::OneNetClient::SetThingModel(
+    std::shared_ptr<const ThingModelIndex> thingModel)
+{
+  thing_model_ = std::move(thingModel);
+}
+
+std::uint64_t cl::OneNetClient::GetRejectionCount(PropertyCheck reason) const
+{
+  return rejections_[static_cast<int>(reason)].load(std::memory_order_relaxed);
+}
+
+void cl::OneNetClient::BeginRequest(JsonWriter& writer)
+{
+  // {"id":"1","version":"1.0","params":{...}}
+  writer.Raw("{\"id\":\"");
+  writer.Int(++next_message_id_);
+  writer.Raw("\",\"version\":\"1.0\",\"params\":{");
+}
+
+tl::expected<void, std::string> cl::OneNetClient::FinishRequest(
+    JsonWriter& writer, const std::string& topic, PublishPriority priority,
+    std::uint64_t coalesceKey)
+{
+  writer.Raw("}}");
+  if (!writer.ok()) {
+    return tl::make_unexpected<std::string>(
+        "failed to serialize request: payload too large or invalid value");
+  }
+
+  return Publish(topic, writer.data(), writer.size(), priority, coalesceKey);
+}
+
+tl::expected<void, std::string> cl::OneNetClient::Publish(
+    const std::string& topic, const char* data, std::size_t size,
+    PublishPriority priority, std::uint64_t coalesceKey)
+{
+  {
+    std::lock_guard<std::mutex> lock{scheduler_mu_};
+    if (!scheduler_.TryAcquire(device_slot_, priority, SteadyNowNs())) {
+      // throttled, or older messages of this priority are still waiting
+      if (!scheduler_.Enqueue(priority, device_slot_, topic, data, size,
+                              coalesceKey)) {
+        return tl::make_unexpected<std::string>(
+            "publish queue full, message shed");
+      }
+      logger_.Debug("publish throttled, queued = {}", scheduler_.size());
+      return {};
+    }
+  }
+
+  return PublishNow(topic, data, size);
+}
+
+tl::expected<void, std::string> cl::OneNetClient::PublishNow(
+    const std::string& topic, const char* data, std::size_t size)
+{
+  logger_.Debug("publish, topic = {}, payload = {}", topic,
+                fmt::string_view(data, size));
+  CL_TRACE_SPAN("publish");
+  if (recorder_) {
+    recorder_->Record(TrafficDirection::kOutbound, topic, data, size);
+  }
+  if (transport_) {
+    transport_->Publish(topic, data, size);
+    return {};
+  }
+  try {
+    mqtt_client_.publish(topic, data, size, 0, false);
+  } catch (mqtt::exception& e) {
+    return tl::make_unexpected<std::string>(
+        e.printable_error(e.get_return_code(), e.get_reason_code(),
+                          e.get_message()));
+  }
+  return {};
+}
+
+tl::expected<void, std::string> cl::OneNetClient::PublishRaw(
+    const std::string& topic, const std::string& payload,
+    PublishPriority priority, std::uint64_t coalesceKey)
+{
+  return Publish(topic, payload.data(), payload.size(), priority,
+                 coalesceKey);
+}
+
+void cl::OneNetClient::InjectMessage(const std::string& topic,
+                                     const std::string& payload)
+{
+  if (receive_mode_ == ReceiveMode::kQueue) {
+    EnqueueMessage(mqtt::make_message(topic, payload));
+    return;
+  }
+  HandleMessage(topic, payload.data(), payload.size());
+}
+
+void cl::OneNetClient::RunPeriodicTasks()
+{
+  FlushPublishQueue();
+  ExpireServiceInvocations(SteadyNowNs());
+}
+
+void cl::OneNetClient::SetTransport(std::shared_ptr<Transport> transport)
+{
+  transport_ = std::move(transport);
+}
+
+void cl::OneNetClient::SetReceiveMode(ReceiveMode mode)
+{
+  receive_mode_ = mode;
+}
+
+std::uint64_t cl::OneNetClient::GetDroppedMessageCount() const
+{
+  return dropped_messages_.load(std::memory_order_relaxed);
+}
+
+void cl::OneNetClient::SetTrafficRecorder(
+    std::shared_ptr<TrafficRecorder> recorder)
+{
+  recorder_ = std::move(recorder);
+}
+
+void cl::OneNetClient::FlushPublishQueue()
+{
+  // publish outside the lock, so uploads and replies are not blocked while
+  // a batch goes out
+  std::uint32_t slots[kFlushBatch];
+  std::size_t taken;
+  do {
+    {
+      std::lock_guard<std::mutex> lock{scheduler_mu_};
+      if (scheduler_.size() == 0) {
+        return;
+      }
+      taken = scheduler_.Take(SteadyNowNs(), slots, kFlushBatch);
+    }
+    for (std::size_t i = 0; i < taken; i++) {
+      const auto& message = scheduler_.message(slots[i]);
+      auto published = PublishNow(message.topic, message.payload.data(),
+                                  message.payload.size());
+      if (!published.has_value()) {
+        logger_.Error("failed to publish queued message: {}",
+                      published.error());
+      }
+    }
+    std::lock_guard<std::mutex> lock{scheduler_mu_};
+    scheduler_.Release(slots, taken);
+  } while (taken == kFlushBatch);
+}
+
+std::uint64_t cl::OneNetClient::GetShedCount(PublishPriority priority) const
+{
+  std::lock_guard<std::mutex> lock{scheduler_mu_};
+  return scheduler_.shed_count(priority);
+}
+
+std::uint64_t cl::OneNetClient::GetCoalescedCount() const
+{
+  std::lock_guard<std::mutex> lock{scheduler_mu_};
+  return scheduler_.coalesced_count();
+}
+
+std::size_t cl::OneNetClient::GetQueuedCount() const
+{
+  std::lock_guard<std::mutex> lock{scheduler_mu_};
+  return scheduler_.size();
+}
+
+std::size_t cl::OneNetClient::GetPendingInvocationCount() const
+{
+  std::lock_guard<std::mutex> lock{invocations_mu_};
+  return invocations_.size();
+}
+
+void cl::OneNetClient::SetPublishLimits(
+    const PublishScheduler::Options& options)
+{
+  if (options.capacity == 0) {
+    logger_.Warn("publish queue capacity 0, using 1");
+  }
+  std::lock_guard<std::mutex> lock{scheduler_mu_};
+  scheduler_ = PublishScheduler{options};
+  device_slot_ = scheduler_.AddDevice();
+}
+
+void cl::OneNetClient::OnMessage(mqtt::const_message_ptr message)
+{
+  if (!message) {
+    return;
+  }
+  // get_payload_str() refers to the message's own buffer, nothing is copied
+  const std::string& payload = message->get_payload_str();
+  logger_.Debug("receive message, topic = {}, size = {}",
+                message->get_topic(), payload.size());
+  if (receive_mode_ == ReceiveMode::kCallback) {
+    HandleMessage(message->get_topic(), payload.data(), payload.size());
+    return;
+  }
+  EnqueueMessage(std::move(message));
+}
+
+void cl::OneNetClient::EnqueueMessage(mqtt::const_message_ptr message)
+{
+  {
+    std::lock_guard<std::mutex> lock{receive_mu_};
+    if (receive_queue_.size() >= CL_ONENET_RECEIVE_QUEUE_CAPACITY) {
+      dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+      logger_.Warn("receive queue full, drop message on {}",
+                   message->get_topic());
+      return;
+    }
+    receive_queue_.push_back(
+        ReceivedMessage{std::move(message),
+                        Tracer::IsEnabled() ? Tracer::Now() : -1});
+  }
+  receive_cv_.notify_one();
+}
+
+void cl::OneNetClient::HandleMessage(const std::string& topic,
+                                     const char* payload, std::size_t size)
+{
+  CL_TRACE_SPAN("handle_message");
+  if (recorder_) {
+    recorder_->Record(TrafficDirection::kInbound, topic, payload, size);
+  }
+  if (topic == property_set_topic_) {
+    HandlePropertySet(payload, size);
+  }
+  else if (topic.compare(0, service_topic_prefix_.size(),
+                         service_topic_prefix_) == 0) {
+    HandleServiceInvoke(topic, payload, size);
+  }
+}
+
+void cl::OneNetClient::HandlePropertySet(const char* payload, std::size_t size)
+{
+  auto request = nlohmann::json::parse(payload, payload + size, nullptr, false);
+  if (request.is_discarded() || !request.contains("id") ||
+      !request["id"].is_string()) {
+    logger_.Warn("invalid property/set request: {}",
+                 fmt::string_view(payload, size));
+    return;
+  }
+  if (!property_set_handler_) {
+    logger_.Warn("property/set received but no handler registered");
+    return;
+  }
+
+  static const nlohmann::json kEmptyParams = nlohmann::json::object();
+  auto params = request.find("params");
+  int code;
+  if (params != request.end() && !DecodeCompressedProperties(*params)) {
+    code = kCodeBadRequest;
+  }
+  else {
+    CL_TRACE_SPAN("property_set_handler");
+    code = property_set_handler_(params != request.end() ? *params
+                                                         : kEmptyParams);
+  }
+
+  // {"id":"<request id>","code":200,"msg":"success"}
+  char reply[256];
+  JsonWriter writer{reply, sizeof(reply)};
+  const auto& id = request["id"].get_ref<const std::string&>();
+  writer.Raw("{\"id\":");
+  writer.String(id.data(), id.size());
+  writer.Raw(",\"code\":");
+  writer.Int(code);
+  writer.Raw(",\"msg\":");
+  writer.String(code == 200 ? "success" : "failed");
+  writer.Char('}');
+  if (!writer.ok()) {
+    logger_.Warn("property/set reply too large, id = {}", id);
+    return;
+  }
+  auto published = Publish(property_set_reply_topic_, writer.data(),
+                           writer.size(), PublishPriority::kReply);
+  if (!published.has_value()) {
+    logger_.Error("failed to reply property/set: {}", published.error());
+  }
 }
 
 tl::expected<std::string, std::string> cl::OneNetClient::BuildCaFile(
     const std::string& content) const
 {
+  CL_TRACE_SPAN("BuildCaFile");
   const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
                        std::chrono::system_clock::now().time_since_epoch())
                        .count();
@@ -102,6 +884,7 @@ tl::expected<std::string, std::string> cl::OneNetClient::BuildCaFile(
 
 tl::expected<std::string, std::string> cl::OneNetClient::BuildToken() const
 {
+  CL_TRACE_SPAN("BuildToken");
   // expired time
   auto expire = std::chrono::system_clock::now() + std::chrono::hours(8760);
   auto et = std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
@@ -162,6 +945,14 @@ std::vector<unsigned char> cl::OneNetClient::HmacSha1(
 
 void cl::OneNetClient::RunLoop()
 {
+  if (transport_) {
+    // nothing to connect to, outgoing messages go to the transport
+    ServeLoop();
+    std::lock_guard<std::mutex> lock{receive_mu_};
+    receive_queue_.clear();
+    return;
+  }
+
   logger_.Info("start connecting");
 
   auto caFile = BuildCaFile(kCaCert);
@@ -191,33 +982,27 @@ void cl::OneNetClient::RunLoop()
                       .finalize();
 
   try {
-    mqtt_client_.start_consuming();
-    auto tok = mqtt_client_.connect(std::move(connOpts));
-    auto rsp = tok->get_connect_response();
-    if (!rsp.is_session_present()) {
+    // a message callback replaces paho's own consumer queue, which has no
+    // size limit; kQueue mode queues into receive_queue_ instead
+    mqtt_client_.set_message_callback(
+        [this](mqtt::const_message_ptr message) {
+          OnMessage(std::move(message));
+        });
+    bool sessionPresent;
+    {
+      // covers the tcp connect, tls handshake and mqtt CONNACK
+      CL_TRACE_SPAN("connect");
+      auto tok = mqtt_client_.connect(std::move(connOpts));
+      sessionPresent = tok->get_connect_response().is_session_present();
+    }
+    if (!sessionPresent) {
       logger_.Info("Subscribing to topics...");
-      const auto topics = mqtt::string_collection::create({
-          fmt::format("$sys/{}/{}/thing/property/post/reply", product_id_,
-                      device_name_),
-          fmt::format("$sys/{}/{}/thing/property/set", product_id_,
-                      device_name_),
-          fmt::format("$sys/{}/{}/thing/property/desired/get/reply",
-                      product_id_, device_name_),
-          fmt::format("$sys/{}/{}/thing/property/desired/delete/reply",
-                      product_id_, device_name_),
-          fmt::format("$sys/{}/{}/thing/property/get", product_id_,
-                      device_name_),
-          fmt::format("$sys/{}/{}/thing/event/post/reply", product_id_,
-                      device_name_),
-          // fmt::format("$sys/{}/{}/thing/service/+/invoke", product_id_,
-          //             device_name_),
-          fmt::format("$sys/{}/{}/thing/sub/property/get", product_id_,
-                      device_name_),
-          fmt::format("$sys/{}/{}/thing/sub/property/set", product_id_,
-                      device_name_),
-      });
+      const auto topics = mqtt::string_collection::create(
+          std::vector<std::string>(subscribe_topics_.begin(),
+                                   subscribe_topics_.end()));
       const std::vector<int> qos((int)topics->size(), 0);
-      mqtt_client_.subscribe(topics, qos);
+      CL_TRACE_SPAN("subscribe");
+      mqtt_client_.subscribe(topics, qos)->wait();
       logger_.Info("subscribe topics success");
     }
     else {
@@ -225,19 +1010,67 @@ void cl::OneNetClient::RunLoop()
     }
 
     logger_.Info("connect ok");
+    ServeLoop();
+  } catch (mqtt::exception& e) {
+    logger_.Error("failed to connect: [client id = {} , error = {}]",
+                  mqtt_client_.get_client_id(),
+                  e.printable_error(e.get_return_code(), e.get_reason_code(),
+                                    e.get_message()));
+  }
+  CloseConnection();
+}
 
-    while (true) {
-      auto msg = mqtt_client_.consume_message();
-      if (!msg) {
-        break;
+void cl::OneNetClient::ServeLoop()
+{
+  const auto tickNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(kFlushInterval)
+          .count();
+  auto lastTick = SteadyNowNs();
+  std::unique_lock<std::mutex> lock{receive_mu_};
+  while (!stop_requested_) {
+    // wake up periodically to publish messages held back by rate limits
+    // and to time out slow service invocations
+    receive_cv_.wait_for(lock, kFlushInterval, [this] {
+      return stop_requested_ || !receive_queue_.empty();
+    });
+    while (!receive_queue_.empty() && !stop_requested_) {
+      ReceivedMessage received = std::move(receive_queue_.front());
+      receive_queue_.pop_front();
+      lock.unlock();
+      if (received.queued_ns >= 0) {
+        Tracer::Record("receive_queue_wait", received.queued_ns,
+                       Tracer::Now() - received.queued_ns);
       }
-      logger_.Info("receive message, topic = {}, payload = {}",
-                   msg->get_topic(), msg->to_string());
+      const std::string& payload = received.message->get_payload_str();
+      HandleMessage(received.message->get_topic(), payload.data(),
+                    payload.size());
+      lock.lock();
+    }
+    const auto now = SteadyNowNs();
+    if (now - lastTick >= tickNs) {
+      lastTick = now;
+      lock.unlock();
+      RunPeriodicTasks();
+      lock.lock();
     }
+  }
+}
+
+void cl::OneNetClient::CloseConnection()
+{
+  // nothing may reach OnMessage once RunLoop has returned
+  mqtt_client_.set_message_callback(nullptr);
+  try {
+    // called while connected or while automatic reconnect is retrying, in
+    // both cases disconnect stops any further reconnect attempt
+    mqtt_client_.disconnect(kDisconnectTimeoutMs)->wait();
   } catch (mqtt::exception& e) {
-    logger_.Error("failed to connect: [client id = {} , error = {}]",
-                  mqtt_client_.get_client_id(),
+    logger_.Debug("disconnect: {}",
                   e.printable_error(e.get_return_code(), e.get_reason_code(),
                                     e.get_message()));
   }
+  {
+    std::lock_guard<std::mutex> lock{receive_mu_};
+    receive_queue_.clear();
+  }
 }
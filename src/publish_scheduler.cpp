@@ -0,0 +1,169 @@
+#include "publish_scheduler.h"
+
+cl::PublishScheduler::PublishScheduler(const Options& options)
+    : options_(options),
+      connection_bucket_(options.connection_rate, options.connection_burst)
+{
+  // SlotRing indexes modulo its capacity
+  if (options_.capacity == 0) {
+    options_.capacity = 1;
+  }
+  slots_.resize(options_.capacity);
+  free_slots_.reserve(options_.capacity);
+  for (std::size_t i = options_.capacity; i > 0; i--) {
+    slots_[i - 1].topic.reserve(options_.topic_reserve);
+    slots_[i - 1].payload.reserve(options_.payload_reserve);
+    free_slots_.push_back(static_cast<std::uint32_t>(i - 1));
+  }
+  for (auto& queue : queues_) {
+    queue = SlotRing{options_.capacity};
+  }
+}
+
+std::uint32_t cl::PublishScheduler::AddDevice()
+{
+  device_buckets_.emplace_back(options_.device_rate, options_.device_burst);
+  return static_cast<std::uint32_t>(device_buckets_.size() - 1);
+}
+
+bool cl::PublishScheduler::TryAcquire(std::uint32_t device,
+                                      PublishPriority priority,
+                                      std::int64_t now_ns)
+{
+  // anything queued at the same or a higher priority goes first
+  for (int p = 0; p <= static_cast<int>(priority); p++) {
+    if (!queues_[p].empty()) {
+      return false;
+    }
+  }
+  auto& bucket = device_buckets_[device];
+  if (!connection_bucket_.Ready(now_ns) || !bucket.TryTake(now_ns)) {
+    return false;
+  }
+  connection_bucket_.TryTake(now_ns);
+  return true;
+}
+
+bool cl::PublishScheduler::Enqueue(PublishPriority priority,
+                                   std::uint32_t device,
+                                   const std::string& topic, const char* data,
+                                   std::size_t size,
+                                   std::uint64_t coalesce_key)
+{
+  auto& queue = queues_[static_cast<int>(priority)];
+  if (coalesce_key != 0) {
+    if (Message* queued = FindCoalesced(queue, device, coalesce_key)) {
+      queued->payload.assign(data, size);
+      coalesced_++;
+      return true;
+    }
+  }
+
+  if (size_ >= options_.capacity && !ShedBelow(priority)) {
+    // nothing of lower priority left, low priority traffic drops its own
+    // oldest message, events and replies are refused
+    if (priority == PublishPriority::kEvent ||
+        priority == PublishPriority::kReply || queue.empty()) {
+      shed_[static_cast<int>(priority)]++;
+      return false;
+    }
+    Remove(queue, 0);
+    shed_[static_cast<int>(priority)]++;
+  }
+  if (free_slots_.empty()) {
+    shed_[static_cast<int>(priority)]++;
+    return false;
+  }
+
+  const std::uint32_t slot = free_slots_.back();
+  free_slots_.pop_back();
+  Message& message = slots_[slot];
+  message.device = device;
+  message.topic.assign(topic);
+  message.payload.assign(data, size);
+  message.coalesce_key = coalesce_key;
+  queue.push_back(slot);
+  size_++;
+  return true;
+}
+
+std::size_t cl::PublishScheduler::Take(std::int64_t now_ns,
+                                       std::uint32_t* slots, std::size_t max)
+{
+  std::size_t taken = 0;
+  for (auto& queue : queues_) {
+    std::size_t i = 0;
+    while (i < queue.size() && i < kScanWindow && taken < max) {
+      if (!connection_bucket_.Ready(now_ns)) {
+        return taken;
+      }
+      auto& bucket = device_buckets_[slots_[queue[i]].device];
+      if (!bucket.TryTake(now_ns)) {
+        // this device is throttled, give the next ones a chance
+        i++;
+        continue;
+      }
+      connection_bucket_.TryTake(now_ns);
+      slots[taken++] = queue[i];
+      queue.erase(i);
+      size_--;
+    }
+  }
+  return taken;
+}
+
+void cl::PublishScheduler::Release(const std::uint32_t* slots,
+                                   std::size_t count)
+{
+  for (std::size_t i = 0; i < count; i++) {
+    FreeSlot(slots[i]);
+  }
+}
+
+cl::PublishScheduler::Message* cl::PublishScheduler::FindCoalesced(
+    const SlotRing& queue, std::uint32_t device, std::uint64_t coalesce_key)
+{
+  // newest first, the latest value for a key is the one most likely queued
+  for (std::size_t scanned = 0;
+       scanned < queue.size() && scanned < kCoalesceWindow; scanned++) {
+    Message& queued = slots_[queue[queue.size() - 1 - scanned]];
+    if (queued.device == device && queued.coalesce_key == coalesce_key) {
+      return &queued;
+    }
+  }
+  return nullptr;
+}
+
+void cl::PublishScheduler::Remove(SlotRing& queue, std::size_t i)
+{
+  FreeSlot(queue[i]);
+  queue.erase(i);
+  size_--;
+}
+
+void cl::PublishScheduler::FreeSlot(std::uint32_t slot)
+{
+  // a slot that took an oversized payload, such as a blob post, would keep
+  // that memory for good; without a reserve payloads grow on demand anyway
+  std::string& payload = slots_[slot].payload;
+  if (options_.payload_reserve > 0 &&
+      payload.capacity() > options_.payload_reserve) {
+    std::string reserved;
+    reserved.reserve(options_.payload_reserve);
+    payload.swap(reserved);
+  }
+  free_slots_.push_back(slot);
+}
+
+bool cl::PublishScheduler::ShedBelow(PublishPriority priority)
+{
+  for (int p = static_cast<int>(PublishPriority::kCount) - 1;
+       p > static_cast<int>(priority); p--) {
+    if (!queues_[p].empty()) {
+      Remove(queues_[p], 0);
+      shed_[p]++;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "base64_openssl.h"
+#include "command_line_parser.h"
+#include "onenet_client.h"
+#include "traffic_log.h"
+#include "transport.h"
+#include "url_util_httplib.h"
+
+// Swallows the client's outgoing traffic and counts it
+class LocalTransport : public cl::Transport {
+ public:
+  void Publish(const std::string&, const char*, std::size_t size) override
+  {
+    messages_++;
+    bytes_ += size;
+  }
+
+  std::uint64_t messages() const { return messages_; }
+  std::uint64_t bytes() const { return bytes_; }
+
+ private:
+  std::atomic<std::uint64_t> messages_{0};
+  std::atomic<std::uint64_t> bytes_{0};
+};
+
+static bool EndsWith(const std::string& s, const std::string& suffix)
+{
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Replies of the recorded session, in log order. The replay answers
+// property/set and service invocations with stub handlers that return the
+// recorded codes, so the client sends the same replies again through its
+// own reply path.
+class RecordedReplies {
+ public:
+  void Add(const cl::TrafficRecord& record)
+  {
+    static const std::string kService = "/thing/service/";
+    const auto service = record.topic.find(kService);
+    if (record.direction == cl::TrafficDirection::kInbound) {
+      if (service != std::string::npos && EndsWith(record.topic, "/invoke")) {
+        const auto begin = service + kService.size();
+        names_.insert(record.topic.substr(
+            begin, record.topic.size() - begin - sizeof("/invoke") + 1));
+      }
+      return;
+    }
+    if (EndsWith(record.topic, "/thing/property/set_reply")) {
+      property_set_.push_back(Parse(record.payload));
+    }
+    else if (service != std::string::npos &&
+             EndsWith(record.topic, "/invoke_reply")) {
+      const auto begin = service + kService.size();
+      services_[record.topic.substr(begin, record.topic.size() - begin -
+                                               sizeof("/invoke_reply") + 1)]
+          .push_back(Parse(record.payload));
+    }
+  }
+
+  /// @brief code of the next recorded property/set reply
+  int NextPropertySet()
+  {
+    std::lock_guard<std::mutex> lock{mu_};
+    return Pop(&property_set_, nullptr);
+  }
+
+  /// @brief code and data of the next recorded reply of a service
+  int NextService(const std::string& identifier, nlohmann::json* data)
+  {
+    std::lock_guard<std::mutex> lock{mu_};
+    return Pop(&services_[identifier], data);
+  }
+
+  /// @brief services invoked in the recorded session
+  const std::set<std::string>& services() const { return names_; }
+
+ private:
+  struct Reply {
+    int code;
+    nlohmann::json data;
+  };
+
+  static Reply Parse(const std::string& payload)
+  {
+    auto reply = nlohmann::json::parse(payload, nullptr, false);
+    if (reply.is_discarded() || !reply.is_object()) {
+      return Reply{200, nlohmann::json::object()};
+    }
+    auto code = reply.find("code");
+    auto data = reply.find("data");
+    return Reply{code != reply.end() && code->is_number_integer()
+                     ? code->get<int>()
+                     : 200,
+                 data != reply.end() ? *data : nlohmann::json::object()};
+  }
+
+  /// @brief requests without a recorded reply are answered with 200
+  static int Pop(std::deque<Reply>* replies, nlohmann::json* data)
+  {
+    if (replies->empty()) {
+      return 200;
+    }
+    Reply reply = std::move(replies->front());
+    replies->pop_front();
+    if (data) {
+      *data = std::move(reply.data);
+    }
+    return reply.code;
+  }
+
+  std::mutex mu_;
+  std::deque<Reply> property_set_;
+  std::map<std::string, std::deque<Reply>> services_;
+  std::set<std::string> names_;
+};
+
+int main(int argc, const char* const argv[])
+{
+  cl::Logger logger{(cl::LogLevel)CL_ONENET_LOG_LEVEL};
+  cl::CommandLineParser argparser{"onenet-replay",
+                                  "replay a recorded onenet session"};
+  argparser.AddMandatory<std::string>("l,log", "traffic log to replay");
+  argparser.AddOptional<double>(
+      "x,speed", "replay speed, 1 = as recorded, 0 = as fast as possible", 1);
+  argparser.AddOptional<bool>("unlimited", "disable publish rate limits",
+                              false);
+  argparser.AddOptionalString("record",
+                              "record the replayed session to this file");
+  auto opts = argparser.Parse(argc, argv);
+
+  auto logFile = opts["log"].as<std::string>();
+  auto speed = opts["speed"].as<double>();
+  auto unlimited = opts["unlimited"].as<bool>();
+  auto recordFile = opts["record"].as<std::string>();
+
+  auto reader = cl::TrafficReader::Open(logFile);
+  if (!reader.has_value()) {
+    logger.Error("{}", reader.error());
+    return 1;
+  }
+
+  // peek at the first record for the $sys/{pid}/{device}/ topic prefix
+  cl::TrafficRecord record;
+  if (!reader.value()->Next(&record)) {
+    logger.Error("empty traffic log {}", logFile);
+    return 1;
+  }
+  const auto pidBegin = record.topic.find('/') + 1;
+  const auto pidEnd = record.topic.find('/', pidBegin);
+  const auto dnEnd = record.topic.find('/', pidEnd + 1);
+  if (pidBegin == 0 || pidEnd == std::string::npos ||
+      dnEnd == std::string::npos) {
+    logger.Error("unexpected topic {}", record.topic);
+    return 1;
+  }
+  const auto pid = record.topic.substr(pidBegin, pidEnd - pidBegin);
+  const auto dn = record.topic.substr(pidEnd + 1, dnEnd - pidEnd - 1);
+
+  std::shared_ptr<cl::Base64> base64 = std::make_shared<cl::Base64Openssl>();
+  std::shared_ptr<cl::UrlUtil> urlUtil = std::make_shared<cl::UrlUtilHttplib>();
+  auto transport = std::make_shared<LocalTransport>();
+  cl::OneNetClient client{true, pid, "", dn, "", base64, urlUtil};
+  client.SetTransport(transport);
+
+  // a first pass over the log collects the replies the stubs give back
+  auto replies = std::make_shared<RecordedReplies>();
+  {
+    auto scan = cl::TrafficReader::Open(logFile);
+    if (!scan.has_value()) {
+      logger.Error("{}", scan.error());
+      return 1;
+    }
+    cl::TrafficRecord scanned;
+    while (scan.value()->Next(&scanned)) {
+      replies->Add(scanned);
+    }
+  }
+  client.SetPropertySetHandler(
+      [replies](const nlohmann::json&) { return replies->NextPropertySet(); });
+  cl::OneNetClient::ServiceOptions serviceOptions;
+  serviceOptions.max_concurrency = CL_ONENET_SERVICE_QUEUE_CAPACITY;
+  for (const auto& identifier : replies->services()) {
+    client.RegisterService(
+        identifier,
+        [replies, identifier](const nlohmann::json&, nlohmann::json* data) {
+          return replies->NextService(identifier, data);
+        },
+        serviceOptions);
+  }
+  if (unlimited) {
+    cl::PublishScheduler::Options limits;
+    limits.device_rate = limits.device_burst = 1e12;
+    limits.connection_rate = limits.connection_burst = 1e12;
+    client.SetPublishLimits(limits);
+  }
+  if (!recordFile.empty()) {
+    auto recorder = cl::TrafficRecorder::Open(recordFile);
+    if (!recorder.has_value()) {
+      logger.Error("{}", recorder.error());
+      return 1;
+    }
+    client.SetTrafficRecorder(std::move(recorder.value()));
+  }
+
+  logger.Info("replay {} for product {}, device {} at {}x", logFile, pid, dn,
+              speed);
+  typedef std::chrono::steady_clock Clock;
+  const auto start = Clock::now();
+  auto lastTick = start;
+  std::uint64_t inbound = 0;
+  std::uint64_t outbound = 0;
+  do {
+    if (speed > 0) {
+      const Clock::time_point due =
+          start + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::nanoseconds(static_cast<std::int64_t>(
+                          record.timestamp_ns / speed)));
+      // keep the periodic work going while waiting for the next record
+      while (Clock::now() < due) {
+        const Clock::time_point tick =
+            Clock::now() + cl::OneNetClient::kFlushInterval;
+        std::this_thread::sleep_until(std::min(due, tick));
+        client.RunPeriodicTasks();
+      }
+    }
+
+    if (record.direction == cl::TrafficDirection::kInbound) {
+      inbound++;
+      client.InjectMessage(record.topic, record.payload);
+    }
+    else if (!EndsWith(record.topic, "_reply")) {
+      // replies are sent again by the client, answering the inbound
+      // requests through the stub handlers
+      outbound++;
+      auto published = client.PublishRaw(
+          record.topic, record.payload,
+          EndsWith(record.topic, "/event/post")
+              ? cl::PublishPriority::kEvent
+              : cl::PublishPriority::kRealtime);
+      if (!published.has_value()) {
+        logger.Warn("publish failed: {}", published.error());
+      }
+    }
+
+    const auto now = Clock::now();
+    if (now - lastTick >= cl::OneNetClient::kFlushInterval) {
+      lastTick = now;
+      client.RunPeriodicTasks();
+    }
+  } while (reader.value()->Next(&record));
+
+  if (!reader.value()->error().empty()) {
+    logger.Warn("replay stopped early: {}", reader.value()->error());
+  }
+  // service replies still running and throttled messages go out at the
+  // configured rate, keep flushing until the last one is published
+  client.RunPeriodicTasks();
+  while (client.GetPendingInvocationCount() > 0 ||
+         client.GetQueuedCount() > 0) {
+    std::this_thread::sleep_for(cl::OneNetClient::kFlushInterval);
+    client.RunPeriodicTasks();
+  }
+
+  const auto seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  logger.Info(
+      "replayed {} inbound and {} outbound messages in {:.3f}s ({:.0f} msg/s), "
+      "client sent {} messages, {} bytes",
+      inbound, outbound, seconds,
+      seconds > 0 ? (inbound + outbound) / seconds : 0.0,
+      transport->messages(), transport->bytes());
+  logger.Info(
+      "shed {} event, {} reply, {} realtime and {} backfill messages, "
+      "coalesced {}",
+      client.GetShedCount(cl::PublishPriority::kEvent),
+      client.GetShedCount(cl::PublishPriority::kReply),
+      client.GetShedCount(cl::PublishPriority::kRealtime),
+      client.GetShedCount(cl::PublishPriority::kBackfill),
+      client.GetCoalescedCount());
+  return 0;
+}
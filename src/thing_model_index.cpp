@@ -0,0 +1,320 @@
+#include "thing_model_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <sstream>
+
+namespace {
+/// @brief member of a json object, null when json is not an object or has no
+/// such member
+const nlohmann::json* Member(const nlohmann::json& json, const char* key)
+{
+  if (!json.is_object()) {
+    return nullptr;
+  }
+  auto it = json.find(key);
+  return it != json.end() ? &*it : nullptr;
+}
+
+/// @brief parse all of s as a number, rejecting empty strings, trailing
+/// characters and values out of range
+bool ParseNumber(const std::string& s, double* out)
+{
+  char* end = nullptr;
+  errno = 0;
+  *out = std::strtod(s.c_str(), &end);
+  return end != s.c_str() && *end == '\0' && errno != ERANGE;
+}
+
+bool ParseInteger(const std::string& s, long long* out)
+{
+  char* end = nullptr;
+  errno = 0;
+  *out = std::strtoll(s.c_str(), &end, 10);
+  return end != s.c_str() && *end == '\0' && errno != ERANGE;
+}
+
+// thing model specs carry numbers as strings ("min": "-40"), accept both.
+// found tells whether specs has the member, false is returned when it is
+// there but not a number
+bool SpecNumber(const nlohmann::json& specs, const char* key, double* out,
+                bool* found)
+{
+  auto it = specs.find(key);
+  *found = it != specs.end();
+  if (!*found) {
+    return true;
+  }
+  if (it->is_number()) {
+    *out = it->get<double>();
+    return true;
+  }
+  return it->is_string() &&
+         ParseNumber(it->get_ref<const std::string&>(), out);
+}
+
+cl::ThingModelIndex::Type ParseType(const std::string& type)
+{
+  typedef cl::ThingModelIndex::Type Type;
+  if (type == "int32") return Type::kInt32;
+  if (type == "int64") return Type::kInt64;
+  if (type == "float") return Type::kFloat;
+  if (type == "double") return Type::kDouble;
+  if (type == "bool") return Type::kBool;
+  if (type == "enum") return Type::kEnum;
+  if (type == "string") return Type::kString;
+  if (type == "date") return Type::kDate;
+  if (type == "bitMap") return Type::kBitMap;
+  return Type::kOther;
+}
+}  // namespace
+
+tl::expected<cl::ThingModelIndex, std::string> cl::ThingModelIndex::Load(
+    const std::string& path)
+{
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    return tl::make_unexpected<std::string>(
+        "failed to open thing model " + path);
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  return Parse(content.str());
+}
+
+tl::expected<cl::ThingModelIndex, std::string> cl::ThingModelIndex::Parse(
+    const std::string& json)
+{
+  auto model = nlohmann::json::parse(json, nullptr, false);
+  if (model.is_discarded() || !model.is_object()) {
+    return tl::make_unexpected<std::string>("invalid thing model json");
+  }
+  auto properties = model.find("properties");
+  if (properties == model.end() || !properties->is_array()) {
+    return tl::make_unexpected<std::string>("thing model has no properties");
+  }
+
+  ThingModelIndex index;
+  // check every member type up front, value() throws on a mismatch
+  static const nlohmann::json kEmpty = nlohmann::json::object();
+  for (const auto& item : *properties) {
+    const auto* id = Member(item, "identifier");
+    if (!id || !id->is_string() || id->get_ref<const std::string&>().empty()) {
+      return tl::make_unexpected<std::string>("property without identifier");
+    }
+    const auto& name = id->get_ref<const std::string&>();
+    const auto* dataType = Member(item, "dataType");
+    const auto* type = dataType ? Member(*dataType, "type") : nullptr;
+    if (!type || !type->is_string()) {
+      return tl::make_unexpected<std::string>("property " + name +
+                                              " has no dataType.type");
+    }
+    const auto* specsMember = Member(*dataType, "specs");
+    const auto& specs =
+        specsMember && specsMember->is_object() ? *specsMember : kEmpty;
+
+    Entry entry{};
+    entry.name_offset = static_cast<std::uint32_t>(index.names_.size());
+    entry.name_size = static_cast<std::uint32_t>(name.size());
+    entry.type = ParseType(type->get_ref<const std::string&>());
+    index.names_ += name;
+
+    switch (entry.type) {
+      case Type::kInt32:
+      case Type::kInt64:
+      case Type::kFloat:
+      case Type::kDouble:
+        if (!SpecNumber(specs, "min", &entry.min, &entry.has_min) ||
+            !SpecNumber(specs, "max", &entry.max, &entry.has_max)) {
+          return tl::make_unexpected<std::string>(
+              "property " + name + " has a malformed min or max");
+        }
+        break;
+      case Type::kString: {
+        double length = 0;
+        bool hasLength = false;
+        if (!SpecNumber(specs, "length", &length, &hasLength) ||
+            length < 0 || length > std::numeric_limits<std::uint32_t>::max()) {
+          return tl::make_unexpected<std::string>(
+              "property " + name + " has a malformed length");
+        }
+        entry.max_length = static_cast<std::uint32_t>(length);
+        break;
+      }
+      case Type::kEnum: {
+        // enum specs map each allowed value to its description
+        entry.enum_begin =
+            static_cast<std::uint32_t>(index.enum_values_.size());
+        for (auto it = specs.begin(); it != specs.end(); ++it) {
+          long long value = 0;
+          if (!ParseInteger(it.key(), &value)) {
+            return tl::make_unexpected<std::string>(
+                "property " + name + " has a malformed enum value " +
+                it.key());
+          }
+          index.enum_values_.push_back(value);
+        }
+        entry.enum_count = static_cast<std::uint32_t>(
+            index.enum_values_.size() - entry.enum_begin);
+        std::sort(index.enum_values_.begin() + entry.enum_begin,
+                  index.enum_values_.end());
+        break;
+      }
+      default:
+        break;
+    }
+    index.entries_.push_back(entry);
+  }
+
+  const auto& names = index.names_;
+  auto key = [&names](const Entry& e) {
+    return std::string(names, e.name_offset, e.name_size);
+  };
+  std::sort(index.entries_.begin(), index.entries_.end(),
+            [&key](const Entry& a, const Entry& b) { return key(a) < key(b); });
+  for (std::size_t i = 1; i < index.entries_.size(); i++) {
+    if (key(index.entries_[i - 1]) == key(index.entries_[i])) {
+      return tl::make_unexpected<std::string>("duplicate property " +
+                                              key(index.entries_[i]));
+    }
+  }
+  return index;
+}
+
+const cl::ThingModelIndex::Entry* cl::ThingModelIndex::Find(
+    const char* id, std::size_t size) const
+{
+  auto compare = [this](const Entry& e, const char* id, std::size_t size) {
+    const int c = std::memcmp(names_.data() + e.name_offset, id,
+                              std::min<std::size_t>(e.name_size, size));
+    return c != 0 ? c : static_cast<int>(e.name_size) - static_cast<int>(size);
+  };
+
+  std::size_t lo = 0;
+  std::size_t hi = entries_.size();
+  while (lo < hi) {
+    const std::size_t mid = lo + (hi - lo) / 2;
+    const int c = compare(entries_[mid], id, size);
+    if (c == 0) {
+      return &entries_[mid];
+    }
+    if (c < 0) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return nullptr;
+}
+
+bool cl::ThingModelIndex::InRange(const Entry& entry, double v) const
+{
+  return (!entry.has_min || v >= entry.min) &&
+         (!entry.has_max || v <= entry.max);
+}
+
+std::size_t cl::ThingModelIndex::MaxLength(const char* id) const
+{
+  const Entry* entry = Find(id, std::strlen(id));
+  return entry ? entry->max_length : 0;
+}
+
+cl::PropertyCheck cl::ThingModelIndex::Check(const Property& property) const
+{
+  const Entry* entry = Find(property.id, std::strlen(property.id));
+  if (!entry) {
+    return PropertyCheck::kUnknownProperty;
+  }
+
+  const auto& value = property.value;
+  typedef PropertyValue::Type ValueType;
+  switch (entry->type) {
+    case Type::kInt32:
+      if (value.type != ValueType::kInt) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      if (value.i < std::numeric_limits<std::int32_t>::min() ||
+          value.i > std::numeric_limits<std::int32_t>::max() ||
+          !InRange(*entry, static_cast<double>(value.i))) {
+        return PropertyCheck::kOutOfRange;
+      }
+      break;
+    case Type::kInt64:
+      if (value.type != ValueType::kInt) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      if (!InRange(*entry, static_cast<double>(value.i))) {
+        return PropertyCheck::kOutOfRange;
+      }
+      break;
+    case Type::kFloat:
+    case Type::kDouble: {
+      double v;
+      if (value.type == ValueType::kDouble) {
+        v = value.d;
+      }
+      else if (value.type == ValueType::kFloat) {
+        v = value.f;
+      }
+      else if (value.type == ValueType::kInt) {
+        v = static_cast<double>(value.i);
+      }
+      else {
+        return PropertyCheck::kTypeMismatch;
+      }
+      if (!InRange(*entry, v)) {
+        return PropertyCheck::kOutOfRange;
+      }
+      break;
+    }
+    case Type::kBool:
+      if (value.type != ValueType::kBool) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      break;
+    case Type::kEnum: {
+      if (value.type != ValueType::kInt) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      const auto begin = enum_values_.begin() + entry->enum_begin;
+      if (!std::binary_search(begin, begin + entry->enum_count, value.i)) {
+        return PropertyCheck::kInvalidEnum;
+      }
+      break;
+    }
+    case Type::kString:
+      if (value.type != ValueType::kString) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      if (entry->max_length > 0 && value.s.size > entry->max_length) {
+        return PropertyCheck::kStringTooLong;
+      }
+      break;
+    case Type::kDate: {
+      std::int64_t date;
+      if (value.type != ValueType::kInt &&
+          (value.type != ValueType::kString ||
+           !ParseDateString(value.s.data, value.s.size, &date))) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      break;
+    }
+    case Type::kBitMap:
+      if (value.type != ValueType::kInt) {
+        return PropertyCheck::kTypeMismatch;
+      }
+      if (value.i < 0) {
+        return PropertyCheck::kOutOfRange;
+      }
+      break;
+    case Type::kOther:
+      break;
+  }
+  return PropertyCheck::kOk;
+}
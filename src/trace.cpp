@@ -0,0 +1,140 @@
+#include "trace.h"
+
+#include <fmt/format.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+// Event slot guarded by a seqlock. While event n is written seq is 2n + 1,
+// afterwards 2n + 2; a reader keeps the copy only if seq was 2n + 2 both
+// before and after it read the fields. The fields are atomic so that a read
+// racing with the writer is not a data race.
+struct TraceSlot {
+  std::atomic<std::uint64_t> seq{0};
+  std::atomic<const char*> name{nullptr};
+  std::atomic<std::int64_t> start_ns{0};
+  std::atomic<std::int64_t> duration_ns{0};
+};
+
+// Single producer ring, only the owning thread writes
+struct TraceRing {
+  std::uint64_t tid = 0;
+  std::atomic<std::uint64_t> head{0};
+  TraceSlot slots[CL_ONENET_TRACE_RING_CAPACITY];
+};
+
+/// @brief copy event n out of slot, false if it was overwritten or is being
+/// written
+bool ReadSlot(const TraceSlot& slot, std::uint64_t n, cl::TraceEvent* out)
+{
+  const std::uint64_t seq = 2 * n + 2;
+  if (slot.seq.load(std::memory_order_acquire) != seq) {
+    return false;
+  }
+  out->name = slot.name.load(std::memory_order_relaxed);
+  out->start_ns = slot.start_ns.load(std::memory_order_relaxed);
+  out->duration_ns = slot.duration_ns.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+const std::chrono::steady_clock::time_point g_epoch =
+    std::chrono::steady_clock::now();
+
+std::mutex g_rings_mu;
+
+std::vector<std::shared_ptr<TraceRing>>& Rings()
+{
+  static std::vector<std::shared_ptr<TraceRing>> rings;
+  return rings;
+}
+
+TraceRing* LocalRing()
+{
+  thread_local std::shared_ptr<TraceRing> ring;
+  if (!ring) {
+    ring = std::make_shared<TraceRing>();
+    std::lock_guard<std::mutex> lock{g_rings_mu};
+    ring->tid = Rings().size() + 1;
+    Rings().push_back(ring);
+  }
+  return ring.get();
+}
+}  // namespace
+
+std::atomic<bool> cl::Tracer::enabled_{false};
+
+std::int64_t cl::Tracer::Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - g_epoch)
+      .count();
+}
+
+void cl::Tracer::Record(const char* name, std::int64_t start_ns,
+                        std::int64_t duration_ns)
+{
+  TraceRing* ring = LocalRing();
+  const auto head = ring->head.load(std::memory_order_relaxed);
+  TraceSlot& slot = ring->slots[head % CL_ONENET_TRACE_RING_CAPACITY];
+  slot.seq.store(2 * head + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start_ns.store(start_ns, std::memory_order_relaxed);
+  slot.duration_ns.store(duration_ns, std::memory_order_relaxed);
+  slot.seq.store(2 * head + 2, std::memory_order_release);
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+std::string cl::Tracer::DumpChromeTrace()
+{
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock{g_rings_mu};
+    rings = Rings();
+  }
+
+  const std::uint64_t capacity = CL_ONENET_TRACE_RING_CAPACITY;
+  fmt::memory_buffer out;
+  fmt::format_to(std::back_inserter(out), "{{\"traceEvents\":[");
+  bool first = true;
+  std::vector<TraceEvent> events;
+  for (const auto& ring : rings) {
+    const auto head = ring->head.load(std::memory_order_acquire);
+    const auto from = head > capacity ? head - capacity : 0;
+    events.clear();
+    // events the writer overwrites meanwhile are dropped
+    TraceEvent event;
+    for (auto i = from; i < head; i++) {
+      if (ReadSlot(ring->slots[i % capacity], i, &event)) {
+        events.push_back(event);
+      }
+    }
+
+    for (const auto& e : events) {
+      fmt::format_to(std::back_inserter(out),
+                     "{}{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{}.{:03},"
+                     "\"dur\":{}.{:03},\"pid\":1,\"tid\":{}}}",
+                     first ? "" : ",", e.name, e.start_ns / 1000,
+                     e.start_ns % 1000, e.duration_ns / 1000,
+                     e.duration_ns % 1000, ring->tid);
+      first = false;
+    }
+  }
+  fmt::format_to(std::back_inserter(out), "],\"displayTimeUnit\":\"ms\"}}");
+  return fmt::to_string(out);
+}
+
+bool cl::Tracer::WriteChromeTrace(const std::string& path)
+{
+  std::ofstream file{path};
+  if (!file.is_open()) {
+    return false;
+  }
+  file << DumpChromeTrace();
+  return file.good();
+}
@@ -0,0 +1,210 @@
+#include "traffic_log.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+const char kMagic[] = {'O', 'N', 'R', 'L'};
+const std::uint8_t kVersion = 1;
+const std::uint8_t kTopicRecord = 0;
+/// @brief guards against allocating for a corrupt length field
+const std::uint64_t kMaxFieldSize = 256 << 20;
+
+std::int64_t SteadyNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
+tl::expected<std::unique_ptr<cl::TrafficRecorder>, std::string>
+cl::TrafficRecorder::Open(const std::string& path)
+{
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    return tl::make_unexpected<std::string>("failed to create " + path);
+  }
+  if (std::fwrite(kMagic, 1, sizeof(kMagic), file) != sizeof(kMagic) ||
+      std::fputc(kVersion, file) == EOF) {
+    std::fclose(file);
+    return tl::make_unexpected<std::string>("failed to write " + path);
+  }
+  return std::unique_ptr<TrafficRecorder>(new TrafficRecorder(file));
+}
+
+cl::TrafficRecorder::TrafficRecorder(std::FILE* file)
+    : file_(file), start_ns_(SteadyNowNs())
+{
+  buffer_.reserve(kBufferSize);
+}
+
+cl::TrafficRecorder::~TrafficRecorder()
+{
+  Flush();
+  std::fclose(file_);
+}
+
+void cl::TrafficRecorder::Record(TrafficDirection direction,
+                                 const std::string& topic, const char* data,
+                                 std::size_t size)
+{
+  const auto now = SteadyNowNs() - start_ns_;
+  std::lock_guard<std::mutex> lock{mu_};
+
+  auto it = topic_ids_.find(topic);
+  if (it == topic_ids_.end()) {
+    const auto id = static_cast<std::uint32_t>(topic_ids_.size());
+    it = topic_ids_.emplace(topic, id).first;
+    buffer_.push_back(static_cast<char>(kTopicRecord));
+    PutVarint(id);
+    PutVarint(topic.size());
+    buffer_.insert(buffer_.end(), topic.begin(), topic.end());
+  }
+
+  // records from several threads may race on the clock, never go backwards
+  const auto delta = now > last_ns_ ? now - last_ns_ : 0;
+  last_ns_ += delta;
+  buffer_.push_back(static_cast<char>(direction));
+  PutVarint(it->second);
+  PutVarint(delta);
+  PutVarint(size);
+  buffer_.insert(buffer_.end(), data, data + size);
+
+  if (buffer_.size() >= kBufferSize) {
+    FlushLocked();
+  }
+}
+
+void cl::TrafficRecorder::Flush()
+{
+  std::lock_guard<std::mutex> lock{mu_};
+  FlushLocked();
+  std::fflush(file_);
+}
+
+void cl::TrafficRecorder::PutVarint(std::uint64_t v)
+{
+  while (v >= 0x80) {
+    buffer_.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  buffer_.push_back(static_cast<char>(v));
+}
+
+void cl::TrafficRecorder::FlushLocked()
+{
+  if (!buffer_.empty()) {
+    std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+    buffer_.clear();
+  }
+}
+
+tl::expected<std::unique_ptr<cl::TrafficReader>, std::string>
+cl::TrafficReader::Open(const std::string& path)
+{
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return tl::make_unexpected<std::string>("failed to open " + path);
+  }
+  char header[sizeof(kMagic) + 1];
+  if (std::fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+    std::fclose(file);
+    return tl::make_unexpected<std::string>(path + " is not a traffic log");
+  }
+  if (static_cast<std::uint8_t>(header[sizeof(kMagic)]) != kVersion) {
+    std::fclose(file);
+    return tl::make_unexpected<std::string>(
+        "unsupported traffic log version in " + path);
+  }
+  return std::unique_ptr<TrafficReader>(new TrafficReader(file));
+}
+
+cl::TrafficReader::TrafficReader(std::FILE* file) : file_(file) {}
+
+cl::TrafficReader::~TrafficReader()
+{
+  std::fclose(file_);
+}
+
+bool cl::TrafficReader::Next(TrafficRecord* record)
+{
+  while (true) {
+    const int kind = std::fgetc(file_);
+    if (kind == EOF) {
+      return false;
+    }
+    std::uint64_t id;
+    if (!GetVarint(&id)) {
+      return false;
+    }
+
+    if (kind == kTopicRecord) {
+      std::uint64_t size;
+      std::string topic;
+      if (!GetVarint(&size) || !GetBytes(size, &topic)) {
+        return false;
+      }
+      if (id != topics_.size()) {
+        error_ = "topic ids out of order";
+        return false;
+      }
+      topics_.push_back(std::move(topic));
+      continue;
+    }
+
+    if (kind != static_cast<int>(TrafficDirection::kInbound) &&
+        kind != static_cast<int>(TrafficDirection::kOutbound)) {
+      error_ = "unknown record kind";
+      return false;
+    }
+    std::uint64_t delta;
+    std::uint64_t size;
+    if (!GetVarint(&delta) || !GetVarint(&size) ||
+        !GetBytes(size, &record->payload)) {
+      return false;
+    }
+    if (id >= topics_.size()) {
+      error_ = "undefined topic id";
+      return false;
+    }
+    last_ns_ += static_cast<std::int64_t>(delta);
+    record->direction = static_cast<TrafficDirection>(kind);
+    record->topic = topics_[id];
+    record->timestamp_ns = last_ns_;
+    return true;
+  }
+}
+
+bool cl::TrafficReader::GetVarint(std::uint64_t* v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int c = std::fgetc(file_);
+    if (c == EOF) {
+      error_ = "truncated record";
+      return false;
+    }
+    *v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  error_ = "invalid varint";
+  return false;
+}
+
+bool cl::TrafficReader::GetBytes(std::uint64_t size, std::string* out)
+{
+  if (size > kMaxFieldSize) {
+    error_ = "record too large";
+    return false;
+  }
+  out->resize(size);
+  if (size > 0 && std::fread(&(*out)[0], 1, size, file_) != size) {
+    error_ = "truncated record";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,104 @@
+#include "work_stealing_executor.h"
+
+#include <utility>
+
+cl::WorkStealingExecutor::WorkStealingExecutor(std::size_t threads,
+                                               std::size_t capacity)
+    : capacity_(capacity)
+{
+  if (threads == 0) {
+    threads = 1;
+  }
+  for (std::size_t i = 0; i < threads; i++) {
+    workers_.emplace_back(new Worker);
+  }
+  for (std::size_t i = 0; i < threads; i++) {
+    threads_.emplace_back(&WorkStealingExecutor::Run, this, i);
+  }
+}
+
+cl::WorkStealingExecutor::~WorkStealingExecutor()
+{
+  Shutdown();
+}
+
+bool cl::WorkStealingExecutor::Submit(Task task)
+{
+  if (stopped_) {
+    return false;
+  }
+  if (queued_.fetch_add(1) >= capacity_) {
+    queued_.fetch_sub(1);
+    return false;
+  }
+
+  auto& worker = *workers_[next_.fetch_add(1) % workers_.size()];
+  {
+    std::lock_guard<std::mutex> lock{worker.mu};
+    worker.tasks.push_back(std::move(task));
+  }
+  {
+    // pairs with the predicate check in Run, no wakeup gets lost
+    std::lock_guard<std::mutex> lock{wake_mu_};
+  }
+  wake_cv_.notify_one();
+  return true;
+}
+
+void cl::WorkStealingExecutor::Shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock{wake_mu_};
+    if (stopped_.exchange(true)) {
+      return;
+    }
+  }
+  wake_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+  for (auto& worker : workers_) {
+    std::lock_guard<std::mutex> lock{worker->mu};
+    queued_.fetch_sub(worker->tasks.size());
+    worker->tasks.clear();
+  }
+}
+
+bool cl::WorkStealingExecutor::TryPop(std::size_t self, Task* task)
+{
+  {
+    auto& own = *workers_[self];
+    std::lock_guard<std::mutex> lock{own.mu};
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.front());
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  for (std::size_t i = 1; i < workers_.size(); i++) {
+    auto& victim = *workers_[(self + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock{victim.mu};
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void cl::WorkStealingExecutor::Run(std::size_t self)
+{
+  // a worker finishes the task it runs, but takes no new one once stopped
+  while (!stopped_) {
+    Task task;
+    if (TryPop(self, &task)) {
+      queued_.fetch_sub(1);
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock{wake_mu_};
+    wake_cv_.wait(lock, [this] { return stopped_ || queued_ > 0; });
+  }
+}
@@ -0,0 +1,151 @@
+// Size and speed of the "$z1:" compressed blob envelope against plain
+// base64, for the payload kinds blob properties carry: text diagnostic
+// dumps, sampled waveforms and incompressible bytes. Every encoded blob is
+// decoded again and must round trip.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base64_openssl.h"
+#include "blob_codec.h"
+#include "test_check.h"
+
+namespace {
+using cl::test::Expect;
+
+typedef std::chrono::steady_clock Clock;
+
+/// @brief bytes encoded per measured case, spread over the iterations
+const std::size_t kBytesPerCase = 8 << 20;
+
+double Seconds(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void Run(const char* name, const std::string& blob)
+{
+  std::vector<char> buffer(cl::CompressedBlobCapacity(blob.size()));
+  const int iterations =
+      static_cast<int>(std::max<std::size_t>(5, kBytesPerCase / blob.size()));
+
+  std::size_t encoded = 0;
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    cl::JsonWriter writer{buffer.data(), buffer.size()};
+    if (!cl::WriteCompressedBlob(writer, blob.data(), blob.size())) {
+      Expect(false, name);
+      return;
+    }
+    encoded = writer.size() - 2;
+  }
+  const double encodeSeconds = Seconds(start) / iterations;
+
+  // without the quotes around the envelope
+  const std::string value{buffer.data() + 1, encoded};
+  bool roundTrip = true;
+  start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    auto decoded =
+        cl::DecodeCompressedBlob(value.data(), value.size(), blob.size());
+    roundTrip = roundTrip && decoded.has_value() && decoded.value() == blob;
+  }
+  const double decodeSeconds = Seconds(start) / iterations;
+
+  cl::Base64Openssl openssl;
+  cl::Base64& base64 = openssl;
+  const std::vector<unsigned char> bytes(blob.begin(), blob.end());
+  std::size_t plain = 0;
+  start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    plain = base64.Encode(bytes).size();
+  }
+  const double base64Seconds = Seconds(start) / iterations;
+
+  std::printf(
+      "%-12s %8zu bytes: base64 %8zu (%7.1f us), $z1 %8zu (%7.1f us enc, "
+      "%7.1f us dec), %5.1f%% of base64\n",
+      name, blob.size(), plain, base64Seconds * 1e6, encoded,
+      encodeSeconds * 1e6, decodeSeconds * 1e6,
+      plain > 0 ? 100.0 * encoded / plain : 0.0);
+  Expect(roundTrip, name);
+}
+
+std::string Waveform(std::size_t size, std::mt19937& rng)
+{
+  std::normal_distribution<double> noise(0, 40);
+  std::string wave;
+  for (std::size_t i = 0; i < size / 2; i++) {
+    const auto sample = static_cast<std::int16_t>(
+        8000 * std::sin(i * 0.05) + 2000 * std::sin(i * 0.31) + noise(rng));
+    wave.append(reinterpret_cast<const char*>(&sample), sizeof(sample));
+  }
+  return wave;
+}
+
+std::string DiagnosticDump(std::size_t size, std::mt19937& rng)
+{
+  static const char* const kLevels[] = {"INFO", "WARN", "DEBUG"};
+  std::string dump;
+  for (int i = 0; dump.size() < size; i++) {
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "2026-10-19 12:%02d:%02d.%03d [%s] modbus slave %d reg "
+                  "0x%04x value=%d crc ok\n",
+                  i / 3600 % 60, i / 60 % 60, static_cast<int>(rng() % 1000),
+                  kLevels[rng() % 3], static_cast<int>(rng() % 8),
+                  static_cast<unsigned>(rng() % 512),
+                  static_cast<int>(rng() % 65536));
+    dump += line;
+  }
+  dump.resize(size);
+  return dump;
+}
+}  // namespace
+
+int main()
+{
+  std::mt19937 rng(1);
+  for (std::size_t size : {4 << 10, 64 << 10, 1 << 20}) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "diag-%zuK", size >> 10);
+    Run(name, DiagnosticDump(size, rng));
+    std::snprintf(name, sizeof(name), "wave-%zuK", size >> 10);
+    Run(name, Waveform(size, rng));
+    std::string random(size, '\0');
+    for (auto& c : random) {
+      c = static_cast<char>(rng());
+    }
+    std::snprintf(name, sizeof(name), "random-%zuK", size >> 10);
+    Run(name, random);
+  }
+
+  // empty blobs and sizes around the 3 KiB encoder chunk
+  for (std::size_t size : {0, 1, 2, 3, 3071, 3072, 3073}) {
+    const std::string blob(size, 'x');
+    std::vector<char> buffer(cl::CompressedBlobCapacity(size));
+    cl::JsonWriter writer{buffer.data(), buffer.size()};
+    const bool written = cl::WriteCompressedBlob(writer, blob.data(), size);
+    auto decoded = cl::DecodeCompressedBlob(buffer.data() + 1,
+                                            writer.size() - 2, size);
+    char name[32];
+    std::snprintf(name, sizeof(name), "round trip %zu bytes", size);
+    Expect(written && decoded.has_value() && decoded.value() == blob, name);
+  }
+
+  // decoding stops at the size limit instead of inflating everything
+  const std::string bomb(1 << 20, 'a');
+  std::vector<char> buffer(cl::CompressedBlobCapacity(bomb.size()));
+  cl::JsonWriter writer{buffer.data(), buffer.size()};
+  cl::WriteCompressedBlob(writer, bomb.data(), bomb.size());
+  Expect(!cl::DecodeCompressedBlob(buffer.data() + 1, writer.size() - 2, 1000)
+              .has_value(),
+         "decode size limit");
+  return cl::test::ExitCode();
+}
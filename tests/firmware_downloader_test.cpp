@@ -0,0 +1,195 @@
+// Downloads a generated image from a local httplib::Server stand-in and
+// reports throughput and peak memory. Checks that resident memory does not
+// grow with the image size, that an interrupted download resumes from its
+// checkpoint in a later run, and that If-Range restarts it when the image
+// changed on the server in the meantime.
+
+#include <httplib.h>
+#include <openssl/evp.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "firmware_downloader.h"
+#include "test_check.h"
+
+#ifndef CL_ONENET_FIRMWARE_TEST_MIB
+#define CL_ONENET_FIRMWARE_TEST_MIB 64
+#endif
+
+/// @brief allowed peak rss growth while downloading, independent of the
+/// image size
+#ifndef CL_ONENET_FIRMWARE_RSS_BUDGET_KB
+#define CL_ONENET_FIRMWARE_RSS_BUDGET_KB 16384
+#endif
+
+namespace {
+const std::uint64_t kImageSize =
+    static_cast<std::uint64_t>(CL_ONENET_FIRMWARE_TEST_MIB) << 20;
+const std::size_t kCheckpointInterval = 4 << 20;
+const std::size_t kChunk = 64 << 10;
+const char kPath[] = "firmware_downloader_test.bin";
+
+using cl::test::Expect;
+
+/// @brief fill out with image bytes [offset, offset + size) of a version
+void Generate(std::uint32_t version, std::uint64_t offset, char* out,
+              std::size_t size)
+{
+  for (std::size_t i = 0; i < size; i++) {
+    const std::uint64_t x = (offset + i) * 2654435761u + version * 40503u;
+    out[i] = static_cast<char>(x >> 13);
+  }
+}
+
+std::string ImageDigest(std::uint32_t version)
+{
+  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+  static char chunk[kChunk];
+  for (std::uint64_t offset = 0; offset < kImageSize; offset += kChunk) {
+    Generate(version, offset, chunk, kChunk);
+    EVP_DigestUpdate(ctx, chunk, kChunk);
+  }
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  EVP_DigestFinal_ex(ctx, md, &size);
+  EVP_MD_CTX_free(ctx);
+  std::string hex;
+  for (unsigned int i = 0; i < size; i++) {
+    char byte[3];
+    std::snprintf(byte, sizeof(byte), "%02x", md[i]);
+    hex += byte;
+  }
+  return hex;
+}
+
+long PeakRssKb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Serves the image with an ETag per version. httplib answers Range requests
+// itself; a mismatching If-Range gets the whole image with status 200.
+class StandIn {
+ public:
+  StandIn()
+  {
+    server_.Get("/firmware.bin", [this](const httplib::Request& req,
+                                        httplib::Response& res) {
+      const std::uint32_t version = version_;
+      const std::string etag = "\"v" + std::to_string(version) + "\"";
+      if (req.has_header("If-Range") &&
+          req.get_header_value("If-Range") != etag) {
+        res.status = 200;
+      }
+      res.set_header("ETag", etag);
+      // cut the connection once, after cut_ bytes of the image
+      const std::uint64_t cut = cut_.exchange(0);
+      res.set_content_provider(
+          kImageSize, "application/octet-stream",
+          [version, cut](std::size_t offset, std::size_t length,
+                         httplib::DataSink& sink) {
+            if (cut > 0 && offset >= cut) {
+              return false;
+            }
+            static thread_local char chunk[kChunk];
+            const std::size_t size = length < kChunk ? length : kChunk;
+            Generate(version, offset, chunk, size);
+            return sink.write(chunk, size);
+          });
+    });
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    thread_ = std::thread([this] { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  ~StandIn()
+  {
+    server_.stop();
+    thread_.join();
+  }
+
+  std::string url() const
+  {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/firmware.bin";
+  }
+
+  void set_version(std::uint32_t version) { version_ = version; }
+  void CutNextAt(std::uint64_t offset) { cut_ = offset; }
+
+ private:
+  httplib::Server server_;
+  std::thread thread_;
+  int port_ = 0;
+  std::atomic<std::uint32_t> version_{1};
+  std::atomic<std::uint64_t> cut_{0};
+};
+
+cl::FirmwareDownloader::Options DownloadOptions(int maxRetries)
+{
+  cl::FirmwareDownloader::Options options;
+  options.checkpoint_interval = kCheckpointInterval;
+  options.max_retries = maxRetries;
+  return options;
+}
+}  // namespace
+
+int main()
+{
+  const std::string progressPath = std::string{kPath} + ".progress";
+  std::remove(kPath);
+  std::remove(progressPath.c_str());
+  const std::string v1 = ImageDigest(1);
+  const std::string v2 = ImageDigest(2);
+
+  StandIn standIn;
+
+  // full download: throughput and peak memory
+  const long rssBefore = PeakRssKb();
+  auto full = cl::FirmwareDownloader{DownloadOptions(0)}.Download(
+      standIn.url(), kPath, v1);
+  const long rssGrowth = PeakRssKb() - rssBefore;
+  Expect(full.has_value(), "full download");
+  if (full.has_value()) {
+    std::printf("%-40s %10.1f MiB/s\n", "throughput",
+                full->size / full->seconds / (1 << 20));
+  }
+  Expect(rssGrowth <= CL_ONENET_FIRMWARE_RSS_BUDGET_KB,
+         "peak rss growth KiB", rssGrowth, CL_ONENET_FIRMWARE_RSS_BUDGET_KB);
+
+  // interrupted, then resumed by a new downloader with the same image
+  std::remove(kPath);
+  standIn.CutNextAt(kImageSize / 2);
+  auto cut = cl::FirmwareDownloader{DownloadOptions(0)}.Download(
+      standIn.url(), kPath, v1);
+  Expect(!cut.has_value(), "interrupted download fails");
+  auto resumed = cl::FirmwareDownloader{DownloadOptions(0)}.Download(
+      standIn.url(), kPath, v1);
+  Expect(resumed.has_value(), "resumed download");
+  if (resumed.has_value()) {
+    Expect(resumed->resumed_from > 0 && resumed->resumed_from < kImageSize,
+           "resumed from checkpoint");
+  }
+
+  // interrupted, then the image changes: If-Range restarts from zero
+  std::remove(kPath);
+  standIn.CutNextAt(kImageSize / 2);
+  cut = cl::FirmwareDownloader{DownloadOptions(0)}.Download(standIn.url(),
+                                                           kPath, v1);
+  Expect(!cut.has_value(), "interrupted download fails");
+  standIn.set_version(2);
+  auto changed = cl::FirmwareDownloader{DownloadOptions(0)}.Download(
+      standIn.url(), kPath, v2);
+  Expect(changed.has_value(), "changed image downloaded again");
+
+  std::remove(kPath);
+  std::remove(progressPath.c_str());
+  return cl::test::ExitCode();
+}
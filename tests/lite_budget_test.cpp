@@ -0,0 +1,149 @@
+// Load run for the onenet-lite profile. Publishing, direct and throttled,
+// must not touch the heap once the client is set up; handling a property/set
+// may only allocate the parsed JSON document, within a fixed per message
+// budget; peak RSS must stay within CL_ONENET_LITE_RSS_BUDGET_KB.
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "base64_openssl.h"
+#include "onenet_client.h"
+#include "test_check.h"
+#include "url_util_httplib.h"
+
+#ifndef CL_ONENET_LITE_RSS_BUDGET_KB
+#define CL_ONENET_LITE_RSS_BUDGET_KB 16384
+#endif
+
+/// @brief heap allocations allowed per handled property/set message
+#ifndef CL_ONENET_LITE_RECEIVE_ALLOC_BUDGET
+#define CL_ONENET_LITE_RECEIVE_ALLOC_BUDGET 32
+#endif
+
+static std::atomic<std::uint64_t> g_allocations{0};
+
+void* operator new(std::size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+namespace {
+class NullTransport : public cl::Transport {
+ public:
+  void Publish(const std::string&, const char*, std::size_t size) override
+  {
+    published++;
+    bytes += size;
+  }
+
+  std::uint64_t published = 0;
+  std::uint64_t bytes = 0;
+};
+
+const int kWarmup = 200;
+const int kIterations = 20000;
+
+using cl::test::Expect;
+
+void UploadLoop(cl::OneNetClient& client, const cl::PropertyBatch& batch,
+                int count)
+{
+  for (int i = 0; i < count; i++) {
+    client.UploadProperties(batch);
+    if (i % 64 == 0) {
+      client.RunPeriodicTasks();
+    }
+  }
+}
+}  // namespace
+
+int main()
+{
+  cl::OneNetClient client{true,
+                          "lite-budget",
+                          "",
+                          "device",
+                          "c2VjcmV0",
+                          std::make_shared<cl::Base64Openssl>(),
+                          std::make_shared<cl::UrlUtilHttplib>()};
+  auto transport = std::make_shared<NullTransport>();
+  client.SetTransport(transport);
+  client.SetPropertySetHandler(
+      [](const nlohmann::json& params) { return params.empty() ? 400 : 200; });
+
+  static const char kLog[] = "0123456789abcdef0123456789abcdef";
+  cl::PropertyBatch batch;
+  batch.push_back(cl::Property{"power", cl::PropertyValue::Bool(true)});
+  batch.push_back(cl::Property{"mode", cl::PropertyValue::Int(3)});
+  batch.push_back(cl::Property{"temperature", cl::PropertyValue::Double(23.5)});
+  batch.push_back(cl::Property{"humidity", cl::PropertyValue::Double(41.25)});
+  batch.push_back(cl::Property{"log", cl::PropertyValue::String(kLog)});
+
+  // unthrottled: every upload is published right away
+  cl::PublishScheduler::Options unlimited;
+  unlimited.device_rate = unlimited.device_burst = 1e12;
+  unlimited.connection_rate = unlimited.connection_burst = 1e12;
+  unlimited.capacity = CL_ONENET_PUBLISH_QUEUE_CAPACITY;
+  client.SetPublishLimits(unlimited);
+  UploadLoop(client, batch, kWarmup);
+  std::uint64_t before = g_allocations.load();
+  UploadLoop(client, batch, kIterations);
+  Expect(g_allocations.load() == before, "direct publish allocations",
+         g_allocations.load() - before, 0);
+
+  // default limits: almost every upload is queued, shed or drained
+  cl::PublishScheduler::Options limited;
+  limited.capacity = CL_ONENET_PUBLISH_QUEUE_CAPACITY;
+  limited.topic_reserve = 128;
+  limited.payload_reserve = CL_ONENET_PAYLOAD_CAPACITY;
+  client.SetPublishLimits(limited);
+  UploadLoop(client, batch, kWarmup);
+  before = g_allocations.load();
+  UploadLoop(client, batch, kIterations);
+  Expect(g_allocations.load() == before, "throttled publish allocations",
+         g_allocations.load() - before, 0);
+
+  // property/set: the parsed request is the only allocation
+  client.SetPublishLimits(unlimited);
+  const std::string topic = "$sys/lite-budget/device/thing/property/set";
+  const std::string request =
+      R"({"id":"42","version":"1.0","params":{"power":false,"mode":1}})";
+  for (int i = 0; i < kWarmup; i++) {
+    client.InjectMessage(topic, request);
+  }
+  const std::uint64_t replies = transport->published;
+  before = g_allocations.load();
+  for (int i = 0; i < kIterations; i++) {
+    client.InjectMessage(topic, request);
+  }
+  const std::uint64_t perMessage =
+      (g_allocations.load() - before) / kIterations;
+  Expect(perMessage <= CL_ONENET_LITE_RECEIVE_ALLOC_BUDGET,
+         "property/set allocations per message", perMessage,
+         CL_ONENET_LITE_RECEIVE_ALLOC_BUDGET);
+  Expect(transport->published - replies == kIterations, "property/set replies",
+         transport->published - replies, kIterations);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  Expect(usage.ru_maxrss <= CL_ONENET_LITE_RSS_BUDGET_KB, "peak rss KiB",
+         usage.ru_maxrss, CL_ONENET_LITE_RSS_BUDGET_KB);
+
+  return cl::test::ExitCode();
+}
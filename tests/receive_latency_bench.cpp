@@ -0,0 +1,154 @@
+// Time from handing a property/set to the client until its set_reply is
+// published, in ReceiveMode::kCallback and kQueue. Requests are injected
+// with at most kWindow of them unanswered, so the receive queue never drops
+// one; every request must get its reply.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base64_openssl.h"
+#include "onenet_client.h"
+#include "test_check.h"
+#include "url_util_httplib.h"
+
+namespace {
+using cl::test::Expect;
+
+typedef std::chrono::steady_clock Clock;
+
+const int kWarmup = 500;
+const int kMessages = 20000;
+/// @brief max requests waiting for their reply
+const int kWindow = 8;
+
+std::int64_t NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+// Stamps the reply to request n with the time it was published, the
+// request id is n.
+class ReplyClock : public cl::Transport {
+ public:
+  explicit ReplyClock(int count)
+      : replied_ns_(new std::atomic<std::int64_t>[count]), count_(count)
+  {
+    for (int i = 0; i < count; i++) {
+      replied_ns_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Publish(const std::string&, const char* data,
+               std::size_t size) override
+  {
+    const std::int64_t now = NowNs();
+    static const char kId[] = "\"id\":\"";
+    const std::string payload{data, size};
+    const auto at = payload.find(kId);
+    if (at != std::string::npos) {
+      const long id = std::strtol(payload.c_str() + at + sizeof(kId) - 1,
+                                  nullptr, 10);
+      if (id >= 0 && id < count_) {
+        replied_ns_[id].store(now, std::memory_order_relaxed);
+      }
+    }
+    replies.fetch_add(1, std::memory_order_release);
+  }
+
+  std::int64_t replied_ns(int id) const
+  {
+    return replied_ns_[id].load(std::memory_order_relaxed);
+  }
+
+  std::atomic<int> replies{0};
+
+ private:
+  std::unique_ptr<std::atomic<std::int64_t>[]> replied_ns_;
+  int count_;
+};
+
+double Percentile(const std::vector<std::int64_t>& sorted, double p)
+{
+  const std::size_t i = static_cast<std::size_t>(p * (sorted.size() - 1));
+  return sorted[i] / 1e3;
+}
+
+void Run(const char* name, cl::OneNetClient::ReceiveMode mode)
+{
+  const int count = kWarmup + kMessages;
+  cl::OneNetClient client{true,
+                          "latency-bench",
+                          "",
+                          "device",
+                          "c2VjcmV0",
+                          std::make_shared<cl::Base64Openssl>(),
+                          std::make_shared<cl::UrlUtilHttplib>()};
+  auto transport = std::make_shared<ReplyClock>(count);
+  client.SetTransport(transport);
+  client.SetReceiveMode(mode);
+  cl::PublishScheduler::Options unlimited;
+  unlimited.device_rate = unlimited.device_burst = 1e12;
+  unlimited.connection_rate = unlimited.connection_burst = 1e12;
+  client.SetPublishLimits(unlimited);
+  client.SetPropertySetHandler(
+      [](const nlohmann::json& params) { return params.empty() ? 400 : 200; });
+  client.Connect();
+
+  const std::string topic = "$sys/latency-bench/device/thing/property/set";
+  std::vector<std::int64_t> injected(count);
+  for (int i = 0; i < count; i++) {
+    while (i - transport->replies.load(std::memory_order_acquire) >=
+           kWindow) {
+      std::this_thread::yield();
+    }
+    const std::string request = "{\"id\":\"" + std::to_string(i) +
+                                "\",\"version\":\"1.0\",\"params\":"
+                                "{\"power\":false,\"mode\":1}}";
+    injected[i] = NowNs();
+    client.InjectMessage(topic, request);
+  }
+  const auto deadline = Clock::now() + std::chrono::seconds(10);
+  while (transport->replies.load(std::memory_order_acquire) < count &&
+         Clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  client.Disconnect();
+
+  std::vector<std::int64_t> latencies;
+  for (int i = kWarmup; i < count; i++) {
+    if (transport->replied_ns(i) > 0) {
+      latencies.push_back(transport->replied_ns(i) - injected[i]);
+    }
+  }
+  const std::string label{name};
+  Expect(transport->replies.load() == count, (label + " replies").c_str(),
+         transport->replies.load(), count);
+  Expect(client.GetDroppedMessageCount() == 0,
+         (label + " dropped messages").c_str(),
+         client.GetDroppedMessageCount(), 0);
+  if (latencies.empty()) {
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::printf("%-10s %6zu messages: p50 %8.1f us, p99 %8.1f us, max %8.1f us\n",
+              name, latencies.size(), Percentile(latencies, 0.5),
+              Percentile(latencies, 0.99), latencies.back() / 1e3);
+}
+}  // namespace
+
+int main()
+{
+  Run("kCallback", cl::OneNetClient::ReceiveMode::kCallback);
+  Run("kQueue", cl::OneNetClient::ReceiveMode::kQueue);
+  return cl::test::ExitCode();
+}
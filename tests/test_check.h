@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+namespace cl {
+namespace test {
+// Checks shared by the test programs. Every check prints one result line;
+// main returns ExitCode(), which is non zero once any check failed.
+
+inline int& Failures()
+{
+  static int failures = 0;
+  return failures;
+}
+
+/// @brief check a measured value against its budget
+inline void Expect(bool ok, const char* what, std::uint64_t actual,
+                   std::uint64_t budget)
+{
+  std::printf("%-40s %10llu (budget %llu) %s\n", what,
+              static_cast<unsigned long long>(actual),
+              static_cast<unsigned long long>(budget), ok ? "ok" : "FAILED");
+  if (!ok) {
+    Failures()++;
+  }
+}
+
+inline void Expect(bool ok, const char* what)
+{
+  std::printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok) {
+    Failures()++;
+  }
+}
+
+inline int ExitCode()
+{
+  return Failures() == 0 ? 0 : 1;
+}
+}  // namespace test
+}  // namespace cl
@@ -0,0 +1,22 @@
+// Instantiates everything thing_model.h generates, so a thing model whose
+// generated code does not compile fails the build here.
+
+#include "thing_model.h"
+
+#include "json_writer.h"
+
+namespace cl {
+namespace thing_model {
+void CheckGeneratedCode(cl::JsonWriter& writer, const nlohmann::json& params)
+{
+  Properties properties;
+  if (properties.Parse(params)) {
+    properties.Serialize(writer);
+  }
+  properties.ForEachProperty([](const cl::Property&) {});
+  auto handler =
+      MakePropertySetHandler([](const Properties&) { return 200; });
+  (void)handler;
+}
+}  // namespace thing_model
+}  // namespace cl
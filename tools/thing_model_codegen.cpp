@@ -0,0 +1,496 @@
+// Generates typed property structs from a OneNET thing model definition.
+//
+// usage: onenet-codegen <thing_model.json> <output.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+struct PropertyDef {
+  /// @brief identifier as defined in the thing model
+  std::string identifier;
+  /// @brief c++ field name
+  std::string field;
+  /// @brief PropertyId enumerator
+  std::string id;
+  /// @brief thing model data type
+  std::string type;
+  /// @brief c++ field type
+  std::string cpp_type;
+  std::string name;
+  bool writable;
+  /// @brief allowed values of an enum property
+  std::vector<std::int64_t> enum_values;
+};
+
+const char kIdentifierChars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+
+const std::set<std::string> kKeywords = {
+    "auto",   "bool",     "break",  "case",     "char",    "class",
+    "const",  "continue", "default", "delete",  "do",      "double",
+    "else",   "enum",     "false",  "float",    "for",     "goto",
+    "if",     "int",      "long",   "namespace", "new",    "operator",
+    "private", "public",  "return", "short",    "signed",  "sizeof",
+    "static", "struct",   "switch", "template", "this",    "true",
+    "try",    "typedef",  "union",  "unsigned", "using",   "virtual",
+    "void",   "volatile", "while",  "present"};
+
+/// @brief names the generated code declares itself, in Properties and in
+/// the PropertyId enum
+const std::set<std::string> kGeneratedNames = {
+    "present", "Serialize", "ForEachProperty", "Parse", "kPropertyCount"};
+
+std::string FieldName(const std::string& identifier)
+{
+  std::string field;
+  for (char c : identifier) {
+    field += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  if (field.empty() || std::isdigit(static_cast<unsigned char>(field[0]))) {
+    field = "p_" + field;
+  }
+  if (kKeywords.count(field)) {
+    field += '_';
+  }
+  return field;
+}
+
+std::string EnumName(const std::string& field)
+{
+  std::string name = "k";
+  bool upper = true;
+  for (char c : field) {
+    if (c == '_') {
+      upper = true;
+      continue;
+    }
+    name += upper ? static_cast<char>(std::toupper(c)) : c;
+    upper = false;
+  }
+  return name;
+}
+
+std::string CppType(const std::string& type)
+{
+  if (type == "int32" || type == "enum") return "std::int32_t";
+  if (type == "int64" || type == "date") return "std::int64_t";
+  if (type == "bitMap") return "std::uint32_t";
+  if (type == "float") return "float";
+  if (type == "double") return "double";
+  if (type == "bool") return "bool";
+  if (type == "string") return "std::string";
+  return "";
+}
+
+std::string WriteCall(const PropertyDef& p)
+{
+  if (p.cpp_type == "bool") return "writer.Bool(" + p.field + ");";
+  if (p.cpp_type == "float") return "writer.Float(" + p.field + ");";
+  if (p.cpp_type == "double") return "writer.Double(" + p.field + ");";
+  if (p.cpp_type == "std::string") {
+    return "writer.String(" + p.field + ".data(), " + p.field + ".size());";
+  }
+  return "writer.Int(" + p.field + ");";
+}
+
+/// @brief condition on the json value `*it` that accepts it for p
+std::string ValueCall(const PropertyDef& p)
+{
+  if (p.cpp_type == "bool") return "cl::PropertyValue::Bool(" + p.field + ")";
+  if (p.cpp_type == "float") {
+    return "cl::PropertyValue::Float(" + p.field + ")";
+  }
+  if (p.cpp_type == "double") {
+    return "cl::PropertyValue::Double(" + p.field + ")";
+  }
+  if (p.cpp_type == "std::string") {
+    return "cl::PropertyValue::String(" + p.field + ".data(), " + p.field +
+           ".size())";
+  }
+  return "cl::PropertyValue::Int(" + p.field + ")";
+}
+
+std::string JsonCheck(const PropertyDef& p)
+{
+  if (p.cpp_type == "bool") return "it->is_boolean()";
+  if (p.cpp_type == "float") return "it->is_number() && FitsFloat(*it)";
+  if (p.cpp_type == "double") return "it->is_number()";
+  if (p.cpp_type == "std::string") return "it->is_string()";
+  std::string check =
+      "it->is_number_integer() && FitsInteger<" + p.cpp_type + ">(*it)";
+  if (p.type == "enum") {
+    check += " &&\n              IsEnumValue(it->get<std::int64_t>(), {";
+    for (std::size_t i = 0; i < p.enum_values.size(); i++) {
+      check += (i > 0 ? ", " : "") + std::to_string(p.enum_values[i]);
+    }
+    check += "})";
+  }
+  return check;
+}
+
+/// @brief parse all of s as a decimal integer
+bool ParseInteger(const std::string& s, std::int64_t* out)
+{
+  char* end = nullptr;
+  errno = 0;
+  const long long v = std::strtoll(s.c_str(), &end, 10);
+  *out = v;
+  return end != s.c_str() && *end == '\0' && errno != ERANGE;
+}
+
+/// @brief single line text for a generated comment
+std::string CommentText(const std::string& text)
+{
+  std::string line = text;
+  for (char& c : line) {
+    if (c == '\n' || c == '\r') {
+      c = ' ';
+    }
+  }
+  return line;
+}
+
+/// @brief string member of a json object, or fallback when it is missing
+/// or not a string
+std::string StringMember(const nlohmann::json& object, const char* key,
+                         const std::string& fallback)
+{
+  auto it = object.find(key);
+  return it != object.end() && it->is_string() ? it->get<std::string>()
+                                               : fallback;
+}
+
+// identifiers are validated against kIdentifierChars, so they never need
+// escaping inside a string literal
+std::string Generate(const std::vector<PropertyDef>& props,
+                     const std::string& source)
+{
+  std::ostringstream out;
+  out << "// Generated by onenet-codegen from " << source << ".\n"
+      << "// Do not edit, changes are overwritten on the next build.\n"
+      << "#pragma once\n\n"
+      << "#include <algorithm>\n"
+      << "#include <bitset>\n"
+      << "#include <cmath>\n"
+      << "#include <cstddef>\n"
+      << "#include <cstdint>\n"
+      << "#include <functional>\n"
+      << "#include <initializer_list>\n"
+      << "#include <limits>\n"
+      << "#include <nlohmann/json.hpp>\n"
+      << "#include <string>\n\n"
+      << "#include \"json_writer.h\"\n"
+      << "#include \"property.h\"\n\n"
+      << "namespace cl {\n"
+      << "namespace thing_model {\n";
+
+  // property/set values are range checked before they are narrowed, so an
+  // out of range number is rejected instead of wrapping
+  out << "/// @brief whether an integer json value fits T\n"
+      << "template <typename T>\n"
+      << "inline bool FitsInteger(const nlohmann::json& v)\n"
+      << "{\n"
+      << "  if (v.is_number_unsigned()) {\n"
+      << "    return v.get<std::uint64_t>() <=\n"
+      << "           static_cast<std::uint64_t>(std::numeric_limits<T>::max());"
+         "\n"
+      << "  }\n"
+      << "  const std::int64_t i = v.get<std::int64_t>();\n"
+      << "  return i >= static_cast<std::int64_t>("
+         "std::numeric_limits<T>::min()) &&\n"
+      << "         (i < 0 || static_cast<std::uint64_t>(i) <=\n"
+      << "                       static_cast<std::uint64_t>(\n"
+      << "                           std::numeric_limits<T>::max()));\n"
+      << "}\n\n"
+      << "/// @brief whether a json number fits a float\n"
+      << "inline bool FitsFloat(const nlohmann::json& v)\n"
+      << "{\n"
+      << "  return std::fabs(v.get<double>()) <=\n"
+      << "         std::numeric_limits<float>::max();\n"
+      << "}\n\n"
+      << "/// @brief whether v is one of the values of an enum property\n"
+      << "inline bool IsEnumValue(std::int64_t v,\n"
+      << "                        std::initializer_list<std::int64_t> "
+         "values)\n"
+      << "{\n"
+      << "  return std::find(values.begin(), values.end(), v) != "
+         "values.end();\n"
+      << "}\n\n"
+      << "/// @brief read a date, a millisecond timestamp sent as a json "
+         "integer or\n"
+      << "/// as a decimal string\n"
+      << "inline bool GetDate(const nlohmann::json& v, std::int64_t* out)\n"
+      << "{\n"
+      << "  if (v.is_number_integer()) {\n"
+      << "    if (!FitsInteger<std::int64_t>(v)) {\n"
+      << "      return false;\n"
+      << "    }\n"
+      << "    *out = v.get<std::int64_t>();\n"
+      << "    return true;\n"
+      << "  }\n"
+      << "  if (!v.is_string()) {\n"
+      << "    return false;\n"
+      << "  }\n"
+      << "  const std::string& s = v.get_ref<const std::string&>();\n"
+      << "  return cl::ParseDateString(s.data(), s.size(), out);\n"
+      << "}\n\n";
+
+  out << "enum PropertyId : std::size_t {\n";
+  for (const auto& p : props) {
+    out << "  " << p.id << ",\n";
+  }
+  out << "  kPropertyCount\n};\n\n";
+
+  out << "struct Properties {\n";
+  for (const auto& p : props) {
+    out << "  /// @brief " << CommentText(p.name) << " (" << p.type
+        << (p.writable ? ", rw" : ", r") << ")\n"
+        << "  " << p.cpp_type << " " << p.field
+        << (p.cpp_type == "std::string" ? "" : " = {}") << ";\n\n";
+  }
+  out << "  /// @brief properties that carry a value\n"
+      << "  std::bitset<kPropertyCount> present;\n";
+
+  for (const auto& p : props) {
+    const bool byRef = p.cpp_type == "std::string";
+    out << "\n  void set_" << p.field << "("
+        << (byRef ? "const " + p.cpp_type + "&" : p.cpp_type) << " v)\n"
+        << "  {\n"
+        << "    " << p.field << " = v;\n"
+        << "    present.set(" << p.id << ");\n"
+        << "  }\n";
+  }
+
+  out << "\n  /// @brief write the present properties as property/post params\n"
+      << "  void Serialize(cl::JsonWriter& writer) const\n"
+      << "  {\n"
+      << "    bool first = true;\n";
+  for (const auto& p : props) {
+    out << "    if (present.test(" << p.id << ")) {\n"
+        << "      if (!first) {\n"
+        << "        writer.Char(',');\n"
+        << "      }\n"
+        << "      first = false;\n"
+        << "      writer.Raw(\"\\\"" << p.identifier
+        << "\\\":{\\\"value\\\":\");\n"
+        << "      " << WriteCall(p) << "\n"
+        << "      writer.Char('}');\n"
+        << "    }\n";
+  }
+  out << "    (void)first;\n"
+      << "  }\n";
+
+  out << "\n  /// @brief call visit(const cl::Property&) for every present "
+         "property\n"
+      << "  template <typename Visit>\n"
+      << "  void ForEachProperty(Visit&& visit) const\n"
+      << "  {\n";
+  for (const auto& p : props) {
+    out << "    if (present.test(" << p.id << ")) {\n"
+        << "      visit(cl::Property{\"" << p.identifier << "\", "
+        << ValueCall(p) << "});\n"
+        << "    }\n";
+  }
+  out << "  }\n";
+
+  out << "\n  /// @brief read property/set params, returns false on an "
+         "unknown,\n"
+      << "  /// read-only, wrongly typed or out of range property, or on a "
+         "value\n"
+      << "  /// an enum property does not define\n"
+      << "  bool Parse(const nlohmann::json& params)\n"
+      << "  {\n"
+      << "    if (!params.is_object()) {\n"
+      << "      return false;\n"
+      << "    }\n"
+      << "    for (auto it = params.begin(); it != params.end(); ++it) {\n"
+      << "      const std::string& key = it.key();\n";
+  bool first = true;
+  for (const auto& p : props) {
+    if (!p.writable) {
+      continue;
+    }
+    out << "      " << (first ? "" : "else ") << "if (key == \"" << p.identifier
+        << "\") {\n";
+    if (p.type == "date") {
+      out << "        std::int64_t date = 0;\n"
+          << "        if (!GetDate(*it, &date)) {\n"
+          << "          return false;\n"
+          << "        }\n"
+          << "        set_" << p.field << "(date);\n";
+    }
+    else {
+      out << "        if (!(" << JsonCheck(p) << ")) {\n"
+          << "          return false;\n"
+          << "        }\n"
+          << "        set_" << p.field << "(it->get<" << p.cpp_type
+          << ">());\n";
+    }
+    out << "      }\n";
+    first = false;
+  }
+  out << "      " << (first ? "" : "else ") << "{\n"
+      << "        return false;\n"
+      << "      }\n"
+      << "    }\n"
+      << "    return true;\n"
+      << "  }\n"
+      << "};\n\n";
+
+  out << "template <PropertyId Id>\n"
+      << "struct PropertyTraits;\n";
+  for (const auto& p : props) {
+    out << "\ntemplate <>\n"
+        << "struct PropertyTraits<" << p.id << "> {\n"
+        << "  typedef " << p.cpp_type << " type;\n"
+        << "  static const char* identifier() { return \"" << p.identifier
+        << "\"; }\n"
+        << "  static type& get(Properties& p) { return p." << p.field
+        << "; }\n"
+        << "  static const type& get(const Properties& p) { return p."
+        << p.field << "; }\n"
+        << "};\n";
+  }
+
+  out << "\n/// @brief adapt a typed handler to "
+         "OneNetClient::SetPropertySetHandler\n"
+      << "inline std::function<int(const nlohmann::json&)> "
+         "MakePropertySetHandler(\n"
+      << "    std::function<int(const Properties&)> handler)\n"
+      << "{\n"
+      << "  return [handler](const nlohmann::json& params) {\n"
+      << "    Properties properties;\n"
+      << "    if (!properties.Parse(params)) {\n"
+      << "      return 400;\n"
+      << "    }\n"
+      << "    return handler(properties);\n"
+      << "  };\n"
+      << "}\n"
+      << "}  // namespace thing_model\n"
+      << "}  // namespace cl\n";
+  return out.str();
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <thing_model.json> <output.h>\n";
+    return 1;
+  }
+
+  std::ifstream in{argv[1]};
+  if (!in.is_open()) {
+    std::cerr << "failed to open thing model " << argv[1] << "\n";
+    return 1;
+  }
+
+  nlohmann::json model;
+  try {
+    in >> model;
+  } catch (nlohmann::json::exception& e) {
+    std::cerr << "failed to parse thing model: " << e.what() << "\n";
+    return 1;
+  }
+
+  auto properties = model.is_object() ? model.find("properties") : model.end();
+  if (properties == model.end() || !properties->is_array()) {
+    std::cerr << "thing model has no properties array\n";
+    return 1;
+  }
+
+  std::vector<PropertyDef> props;
+  // generated c++ names, each mapped to the identifier it was made from
+  std::map<std::string, std::string> names;
+  for (const auto& name : kGeneratedNames) {
+    names[name] = "";
+  }
+  for (const auto& item : *properties) {
+    if (!item.is_object()) {
+      std::cerr << "property entry is not an object\n";
+      return 1;
+    }
+    auto identifier = item.find("identifier");
+    if (identifier == item.end() || !identifier->is_string()) {
+      std::cerr << "property without a string identifier\n";
+      return 1;
+    }
+    PropertyDef p;
+    p.identifier = identifier->get<std::string>();
+    auto dataType = item.find("dataType");
+    if (dataType == item.end() || !dataType->is_object() ||
+        !dataType->contains("type") || !(*dataType)["type"].is_string()) {
+      std::cerr << "property " << p.identifier << " has no dataType.type\n";
+      return 1;
+    }
+    p.type = (*dataType)["type"].get<std::string>();
+    p.name = StringMember(item, "name", p.identifier);
+    p.cpp_type = CppType(p.type);
+    p.writable =
+        StringMember(item, "accessMode", "r").find('w') != std::string::npos;
+    p.field = FieldName(p.identifier);
+    p.id = EnumName(p.field);
+    if (p.identifier.empty() ||
+        p.identifier.find_first_not_of(kIdentifierChars) != std::string::npos) {
+      std::cerr << "invalid property identifier '" << p.identifier << "'\n";
+      return 1;
+    }
+    if (p.cpp_type.empty()) {
+      std::cerr << "skip property " << p.identifier << ", unsupported type "
+                << p.type << "\n";
+      continue;
+    }
+    if (p.type == "enum") {
+      const auto specs = dataType->find("specs");
+      if (specs != dataType->end() && specs->is_object()) {
+        for (auto it = specs->begin(); it != specs->end(); ++it) {
+          std::int64_t value = 0;
+          if (!ParseInteger(it.key(), &value)) {
+            std::cerr << "property " << p.identifier
+                      << " has a malformed enum value " << it.key() << "\n";
+            return 1;
+          }
+          p.enum_values.push_back(value);
+        }
+      }
+    }
+    // "a_b", "aB" and "a__b" all become kAB, "set_x" clashes with the
+    // setter of "x"
+    for (const auto& name : {p.field, "set_" + p.field, p.id}) {
+      auto inserted = names.insert(std::make_pair(name, p.identifier));
+      if (inserted.second) {
+        continue;
+      }
+      const std::string& other = inserted.first->second;
+      if (other == p.identifier) {
+        std::cerr << "duplicate property " << p.identifier << "\n";
+      }
+      else {
+        std::cerr << "property " << p.identifier << " and "
+                  << (other.empty() ? "generated code" : "property " + other)
+                  << " both map to the c++ name " << name << "\n";
+      }
+      return 1;
+    }
+    props.push_back(p);
+  }
+
+  std::ofstream outFile{argv[2]};
+  if (!outFile.is_open()) {
+    std::cerr << "failed to write " << argv[2] << "\n";
+    return 1;
+  }
+  outFile << Generate(props, argv[1]);
+  return 0;
+}